@@ -0,0 +1,661 @@
+// 块缓存 (bio.c)
+//
+// 在内存中缓存磁盘块, 同一个块被重复读时不再访问设备。
+//
+// 缓存的大小在binit时按伙伴系统的空闲内存确定(约1/8)。缓冲区按
+// (dev, blockno)挂在哈希表上, 每个桶一把锁, 命中时只持有一个桶锁。
+// 不命中时用CLOCK算法挑选换出的缓冲区: 时钟指针扫过所有缓冲区,
+// 访问位为1的清零后跳过(第二次机会), 有引用、脏或者正在I/O的不能换出。
+// 换出由clock_lock串行化, 锁的顺序是clock_lock -> 目标桶 -> 换出者的桶,
+// 同一时刻只有一个换出者会持有两个桶锁, 不会死锁。
+//
+// 每个设备记录最近一次读的块号, 连续读超过RA_TRIGGER次后, 在读到
+// 预读窗口的一半时异步读入后面RA_WINDOW个块, 相邻的块合并成一个
+// 多段请求, 一批请求只通知设备一次。
+//
+// bwrite只把缓冲区标记为脏, 由bflushd线程定期(或脏块过多时)
+// 按块号排序后批量写回; 需要落盘时调用bsync。脏缓冲区按变脏的顺序
+// 挂在dirty链表上, bflushd从链表头取一批, 不扫描整个缓存。定期写回的定时器只在
+// 有脏块时运行: 第一个脏块出现时启动, 到期时缓存已经干净就不再启动,
+// 空闲时不产生周期性的唤醒。
+//
+// 缓冲区的B_BUSY标志起睡眠锁的作用: bread返回时已经锁住, brelse解锁。
+// 异步I/O期间缓冲区也是B_BUSY的, 由完成回调解锁。
+// 单核上关中断检查B_BUSY再睡眠, 不会丢失唤醒。
+
+#include "types.h"
+#include "paging.h"
+#include "proc.h"
+#include "timer.h"
+#include "blk.h"
+#include "buf.h"
+#include "global_func.h"
+
+#define NBUF_MIN 16
+#define NBUF_MAX 4096
+#define NBUCKET_MIN 16
+#define NBUCKET_MAX 64
+
+#define SECTORS_PER_BLOCK (BSIZE / BLK_SECTOR_SIZE)
+
+#define RA_TRIGGER 2            // 连续读这么多次后开始预读
+#define RA_WINDOW 32            // 每次预读的块数
+#define NRA 4                   // 记录顺序访问状态的设备数
+
+#define WB_BATCH 64             // bflushd一次收集的最大脏块数
+#define WB_SCAN (2 * WB_BATCH)  // 收集一批时最多检查的脏块数, 限制关中断的时间
+#define FLUSH_INTERVAL_US 1000000 // 定期写回的间隔
+
+struct bucket {
+  struct spinlock lock;
+  struct list head;
+};
+
+// 一个设备上的顺序访问状态
+struct ra_state {
+  uint dev;
+  int used;
+  uint last;                    // 上一次读的块号
+  int seq;                      // 连续读的次数
+  uint next;                    // 已经发起预读的块的下一个
+};
+
+// 一个块设备请求和它覆盖的缓冲区, 完成时在bio_end_io中释放
+struct bio_rq {
+  struct blk_req req;
+  int write;
+  int n;
+  struct buf *bufs[BLK_MAX_SEGS];
+};
+
+static struct {
+  struct buf *buf;
+  int nbuf;
+  struct bucket *buckets;
+  int nbucket;                  // 2的幂
+  struct spinlock clock_lock;   // 串行化换出, 保护时钟指针
+  int hand;
+
+  struct ra_state ra[NRA];
+
+  struct spinlock dirty_lock;   // 保护dirty和ndirty, 在桶锁之前获取
+  struct list dirty;            // 还没有开始写回的脏缓冲区
+  int ndirty;                   // 脏缓冲区数, 包括正在写回的
+  int wb_inflight;              // bflushd发出的还没完成的写请求数
+  int flush_kick;               // bflushd有工作要做
+  struct proc *flushd;
+  struct timer flush_timer;
+
+  // 统计
+  uint64 nhit;
+  uint64 nmiss;
+  uint64 nra;                   // 预读的块数
+  uint64 nra_hit;               // 预读的块后来被读到的次数
+  uint64 nevict;
+  uint64 nwriteback;            // 写回的块数
+  uint64 nwb_req;               // 写回的请求数
+} bcache;
+
+static struct bucket *
+bucket_of(int i)
+{
+  return &bcache.buckets[i];
+}
+
+static int
+bhash(uint dev, uint blockno)
+{
+  uint64 key = ((uint64)dev << 32) | blockno;
+  return ((key * 0x9E3779B97F4A7C15UL) >> 32) & (bcache.nbucket - 1);
+}
+
+static void
+flush_kick(void)
+{
+  push_off();
+  bcache.flush_kick = 1;
+  wakeup(&bcache.flushd);
+  pop_off();
+}
+
+// 在桶h中查找, 调用者持有桶锁
+static struct buf *
+bucket_find(int h, uint dev, uint blockno)
+{
+  struct list *head = &bucket_of(h)->head;
+
+  for(struct list *e = head->next; e != head; e = e->next){
+    struct buf *b = lst_entry(e, struct buf, hash_link);
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  }
+  return 0;
+}
+
+// CLOCK: 找一个可以换出的缓冲区, 挂到桶h上并返回, 持有它原来的桶锁时改动。
+// 调用者持有clock_lock和桶h的锁。没有可换出的返回0。
+static struct buf *
+clock_evict(int h, uint dev, uint blockno)
+{
+  for(int n = 0; n < 2 * bcache.nbuf; n++){
+    struct buf *b = &bcache.buf[bcache.hand];
+    int old = b->bucket;
+
+    bcache.hand = (bcache.hand + 1) % bcache.nbuf;
+    if(old >= 0 && old != h)
+      acquire(&bucket_of(old)->lock);
+    if(b->refcnt || (b->flags & (B_DIRTY | B_BUSY))){
+      if(old >= 0 && old != h)
+        release(&bucket_of(old)->lock);
+      continue;
+    }
+    if(b->flags & B_REF){
+      b->flags &= ~B_REF;
+      if(old >= 0 && old != h)
+        release(&bucket_of(old)->lock);
+      continue;
+    }
+    if(old >= 0){
+      lst_remove(&b->hash_link);
+      if(b->flags & B_VALID)
+        bcache.nevict++;
+      if(old != h)
+        release(&bucket_of(old)->lock);
+    }
+    b->dev = dev;
+    b->blockno = blockno;
+    b->flags = B_REF;
+    b->refcnt = 1;
+    b->bucket = h;
+    lst_push(&bucket_of(h)->head, &b->hash_link);
+    return b;
+  }
+  return 0;
+}
+
+// 取得(dev, blockno)的缓冲区并加一个引用, 不加锁。
+// 缓存满了时wait为1就等bflushd写回后重试, 为0则返回0。
+static struct buf *
+bget(uint dev, uint blockno, int wait)
+{
+  int h = bhash(dev, blockno);
+  struct bucket *bk = bucket_of(h);
+  struct buf *b;
+
+  for(;;){
+    // 快速路径: 只持有一个桶锁
+    acquire(&bk->lock);
+    if((b = bucket_find(h, dev, blockno)) != 0){
+      b->refcnt++;
+      b->flags |= B_REF;
+      release(&bk->lock);
+      return b;
+    }
+    release(&bk->lock);
+
+    // 不命中: 串行化换出, 拿到桶锁后重新查找
+    acquire(&bcache.clock_lock);
+    acquire(&bk->lock);
+    if((b = bucket_find(h, dev, blockno)) != 0){
+      b->refcnt++;
+      b->flags |= B_REF;
+    } else {
+      b = clock_evict(h, dev, blockno);
+    }
+    release(&bk->lock);
+    release(&bcache.clock_lock);
+    if(b || !wait)
+      return b;
+
+    // 所有缓冲区都在使用或是脏的, 让bflushd写回一些
+    flush_kick();
+    yield();
+  }
+}
+
+// 丢掉bget得到的引用
+static void
+bput(struct buf *b)
+{
+  struct bucket *bk = bucket_of(b->bucket);
+
+  acquire(&bk->lock);
+  if(b->refcnt <= 0)
+    panic("bput");
+  b->refcnt--;
+  release(&bk->lock);
+}
+
+// 设置B_BUSY, 已经被占用时返回0
+static int
+b_trylock(struct buf *b)
+{
+  struct bucket *bk = bucket_of(b->bucket);
+  int ok = 0;
+
+  acquire(&bk->lock);
+  if((b->flags & B_BUSY) == 0){
+    b->flags |= B_BUSY;
+    ok = 1;
+  }
+  release(&bk->lock);
+  return ok;
+}
+
+static void
+b_lock(struct buf *b)
+{
+  push_off();
+  while(!b_trylock(b))
+    sleep(b);
+  pop_off();
+}
+
+// 修改b的标志。B_REF可能被bget同时设置, 所以持有桶锁修改。
+static void
+b_flags(struct buf *b, int set, int clear)
+{
+  struct bucket *bk = bucket_of(b->bucket);
+
+  acquire(&bk->lock);
+  b->flags = (b->flags | set) & ~clear;
+  release(&bk->lock);
+}
+
+// 清除B_BUSY并唤醒等待者, set和clear是同时要改的其他标志
+static void
+b_unlock(struct buf *b, int set, int clear)
+{
+  b_flags(b, set, clear | B_BUSY);
+  wakeup(b);
+}
+
+// 把已经从dirty链表上取下的脏块放回去, 调用者锁住了b
+static void
+dirty_requeue(struct buf *b)
+{
+  acquire(&bcache.dirty_lock);
+  lst_push_back(&bcache.dirty, &b->dirty_link);
+  release(&bcache.dirty_lock);
+}
+
+// 请求完成, 在软中断中调用(没有磁盘时在提交者的上下文中)
+static void
+bio_end_io(struct blk_req *r)
+{
+  struct bio_rq *rq = r->private;
+
+  for(int i = 0; i < rq->n; i++){
+    struct buf *b = rq->bufs[i];
+
+    if(r->status < 0)
+      b_unlock(b, 0, B_RA);     // 读失败, bread会同步重读
+    else if(rq->write)
+      b_unlock(b, 0, B_DIRTY);
+    else
+      b_unlock(b, B_VALID, 0);
+    bput(b);
+  }
+  if(rq->write){
+    if(r->status < 0)
+      panic("bio: write error");
+    acquire(&bcache.dirty_lock);
+    bcache.ndirty -= rq->n;
+    release(&bcache.dirty_lock);
+    bcache.nwriteback += rq->n;
+    if(__atomic_sub_fetch(&bcache.wb_inflight, 1, __ATOMIC_RELAXED) == 0)
+      wakeup(&bcache.wb_inflight);
+  }
+  kfree(rq);
+}
+
+// 异步读写n个缓冲区, 它们已经被调用者锁住并各持有一个引用, 按块号排好序。
+// 块号连续的缓冲区合并成一个多段请求, 所有请求一次提交。
+// 完成时解锁并丢掉引用。
+static void
+bio_submit(struct buf **bufs, int n, int write)
+{
+  struct blk_req *reqs[WB_BATCH];
+  struct bio_rq *rq = 0;
+  int nreq = 0;
+
+  for(int i = 0; i < n; i++){
+    struct buf *b = bufs[i];
+
+    if(rq == 0 || rq->n == BLK_MAX_SEGS ||
+       rq->bufs[0]->dev != b->dev || rq->bufs[rq->n - 1]->blockno + 1 != b->blockno){
+      if(nreq == WB_BATCH){
+        virtio_blk_submit(reqs, nreq);
+        nreq = 0;
+      }
+      if((rq = kmalloc(sizeof(*rq))) == 0){
+        // 没有内存, 剩下的缓冲区放弃这次I/O, 脏块放回dirty链表
+        for(; i < n; i++){
+          if(write)
+            dirty_requeue(bufs[i]);
+          b_unlock(bufs[i], 0, B_RA);
+          bput(bufs[i]);
+        }
+        break;
+      }
+      rq->req.sector = (uint64)b->blockno * SECTORS_PER_BLOCK;
+      rq->req.write = write;
+      rq->req.nseg = 0;
+      rq->req.end_io = bio_end_io;
+      rq->req.private = rq;
+      rq->write = write;
+      rq->n = 0;
+      if(write)
+        __atomic_fetch_add(&bcache.wb_inflight, 1, __ATOMIC_RELAXED);
+      reqs[nreq++] = &rq->req;
+    }
+    rq->req.seg[rq->req.nseg].addr = b->data;
+    rq->req.seg[rq->req.nseg].len = BSIZE;
+    rq->req.nseg++;
+    rq->bufs[rq->n++] = b;
+  }
+  if(nreq)
+    virtio_blk_submit(reqs, nreq);
+}
+
+// 异步读入[start, end)中还不在缓存里的块。不等待缓冲区, 缓存满了就停止。
+static void
+readahead(uint dev, uint start, uint end)
+{
+  struct buf *bufs[RA_WINDOW];
+  uint64 nblocks = virtio_blk_capacity() / SECTORS_PER_BLOCK;
+  int n = 0;
+
+  if(end > nblocks)
+    end = nblocks;
+  for(uint blockno = start; blockno < end && n < RA_WINDOW; blockno++){
+    struct buf *b = bget(dev, blockno, 0);
+
+    if(b == 0)
+      break;
+    if((b->flags & B_VALID) || !b_trylock(b)){
+      bput(b);
+      continue;
+    }
+    if(b->flags & B_VALID){
+      b_unlock(b, 0, 0);
+      bput(b);
+      continue;
+    }
+    b_flags(b, B_RA, 0);
+    bufs[n++] = b;
+  }
+  bcache.nra += n;
+  if(n)
+    bio_submit(bufs, n, 0);
+}
+
+// 记录一次对blockno的读, 顺序读时按需发起预读
+static void
+ra_update(uint dev, uint blockno)
+{
+  struct ra_state *ra = 0;
+  uint start = 0, end = 0;
+
+  push_off();
+  for(int i = 0; i < NRA; i++){
+    if(bcache.ra[i].used && bcache.ra[i].dev == dev){
+      ra = &bcache.ra[i];
+      break;
+    }
+    if(ra == 0 && !bcache.ra[i].used)
+      ra = &bcache.ra[i];
+  }
+  if(ra == 0)
+    ra = &bcache.ra[dev % NRA];
+  if(!ra->used || ra->dev != dev){
+    ra->used = 1;
+    ra->dev = dev;
+    ra->seq = 0;
+    ra->next = 0;
+  } else if(blockno == ra->last + 1){
+    ra->seq++;
+  } else if(blockno != ra->last){
+    ra->seq = 0;
+    ra->next = 0;
+  }
+  ra->last = blockno;
+
+  // 读到预读窗口的后一半时发起下一个窗口, I/O与消费重叠
+  if(ra->seq >= RA_TRIGGER && blockno + RA_WINDOW / 2 >= ra->next){
+    start = ra->next > blockno ? ra->next : blockno + 1;
+    end = blockno + 1 + RA_WINDOW;
+    ra->next = end;
+  }
+  pop_off();
+
+  if(start < end)
+    readahead(dev, start, end);
+}
+
+// 返回块(dev, blockno)的缓冲区, 内容有效并且已经锁住
+struct buf *
+bread(uint dev, uint blockno)
+{
+  struct buf *b = bget(dev, blockno, 1);
+
+  b_lock(b);
+  if(b->flags & B_VALID){
+    bcache.nhit++;
+    if(b->flags & B_RA){
+      bcache.nra_hit++;
+      b_flags(b, 0, B_RA);
+    }
+  } else {
+    struct blk_req r;
+
+    bcache.nmiss++;
+    r.sector = (uint64)blockno * SECTORS_PER_BLOCK;
+    r.write = 0;
+    r.nseg = 1;
+    r.seg[0].addr = b->data;
+    r.seg[0].len = BSIZE;
+    if(virtio_blk_rw(&r) < 0)
+      panic("bread");
+    b_flags(b, B_VALID, B_RA);
+  }
+  ra_update(dev, blockno);
+  return b;
+}
+
+// 修改了b的内容, b必须已经锁住。只标记为脏, 由bflushd写回。
+void
+bwrite(struct buf *b)
+{
+  int n;
+
+  if((b->flags & B_BUSY) == 0)
+    panic("bwrite");
+  if(b->flags & B_DIRTY)
+    return;
+  b_flags(b, B_DIRTY | B_VALID, 0);
+  acquire(&bcache.dirty_lock);
+  lst_push_back(&bcache.dirty, &b->dirty_link);
+  n = ++bcache.ndirty;
+  release(&bcache.dirty_lock);
+  if(n == 1){
+    // 缓存由干净变脏, 启动定期写回
+    push_off();
+    if(!timer_pending(&bcache.flush_timer))
+      timer_add(&bcache.flush_timer, r_time() + US2CYCLES(FLUSH_INTERVAL_US));
+    pop_off();
+  }
+  if(n > bcache.nbuf / 4)
+    flush_kick();
+}
+
+// 解锁并释放bread得到的缓冲区
+void
+brelse(struct buf *b)
+{
+  if((b->flags & B_BUSY) == 0)
+    panic("brelse");
+  b_unlock(b, 0, 0);
+  bput(b);
+}
+
+static void
+sort_by_block(struct buf **bufs, int n)
+{
+  for(int i = 1; i < n; i++){
+    struct buf *b = bufs[i];
+    int j = i - 1;
+    for(; j >= 0 && (bufs[j]->dev > b->dev ||
+                     (bufs[j]->dev == b->dev && bufs[j]->blockno > b->blockno)); j--)
+      bufs[j + 1] = bufs[j];
+    bufs[j + 1] = b;
+  }
+}
+
+// 把所有没有被占用的脏块写回。每批从dirty链表头取最多WB_BATCH个,
+// 按块号排序后合并成尽量少的请求一次提交, 等这一批完成再取下一批。
+// 被别人锁住的脏块移到链表尾, 每批最多检查WB_SCAN个。
+static void
+bflush(void)
+{
+  static struct buf *bufs[WB_BATCH];
+  int n;
+
+  do {
+    struct list *e, *next;
+    int scanned = 0;
+
+    n = 0;
+    acquire(&bcache.dirty_lock);
+    for(e = bcache.dirty.next; e != &bcache.dirty && n < WB_BATCH && scanned < WB_SCAN; e = next){
+      struct buf *b = lst_entry(e, struct buf, dirty_link);
+      // 脏缓冲区不会被换出, b->bucket不变
+      struct bucket *bk = bucket_of(b->bucket);
+
+      next = e->next;
+      scanned++;
+      lst_remove(e);
+      acquire(&bk->lock);
+      if((b->flags & B_BUSY) == 0){
+        b->flags |= B_BUSY;
+        b->refcnt++;
+        bufs[n++] = b;
+      } else {
+        lst_push_back(&bcache.dirty, e);
+      }
+      release(&bk->lock);
+    }
+    release(&bcache.dirty_lock);
+
+    if(n == 0)
+      break;
+    sort_by_block(bufs, n);
+    bio_submit(bufs, n, 1);
+    bcache.nwb_req++;
+
+    push_off();
+    while(bcache.wb_inflight)
+      sleep(&bcache.wb_inflight);
+    pop_off();
+  } while(n > 0);
+
+  wakeup(&bcache.ndirty);
+}
+
+static void
+bflushd_thread(void *arg)
+{
+  for(;;){
+    push_off();
+    while(!bcache.flush_kick)
+      sleep(&bcache.flushd);
+    bcache.flush_kick = 0;
+    pop_off();
+    bflush();
+  }
+}
+
+// 有脏块时定期唤醒bflushd, 在TIMER_SOFTIRQ中调用。
+// 缓存已经干净时不再启动, 等bwrite产生下一个脏块。
+static void
+flush_timer_fn(void *arg)
+{
+  if(bcache.ndirty == 0)
+    return;
+  bcache.flush_kick = 1;
+  wakeup(&bcache.flushd);
+  timer_add(&bcache.flush_timer, r_time() + US2CYCLES(FLUSH_INTERVAL_US));
+}
+
+// 把所有脏块写回磁盘后返回
+void
+bsync(void)
+{
+  push_off();
+  while(bcache.ndirty){
+    bcache.flush_kick = 1;
+    wakeup(&bcache.flushd);
+    sleep(&bcache.ndirty);
+  }
+  pop_off();
+}
+
+// 打印命中率等统计, 调试用
+void
+bio_stat_print(void)
+{
+  uint64 total = bcache.nhit + bcache.nmiss;
+
+  printf("bio: %d bufs, %d buckets, %d dirty\n", bcache.nbuf, bcache.nbucket, bcache.ndirty);
+  printf("bio: %lu hits, %lu misses, hit rate %lu%%, %lu evictions\n",
+         bcache.nhit, bcache.nmiss, total ? bcache.nhit * 100 / total : 0, bcache.nevict);
+  printf("bio: readahead %lu blocks, %lu used; writeback %lu blocks in %lu batches\n",
+         bcache.nra, bcache.nra_hit, bcache.nwriteback, bcache.nwb_req);
+}
+
+// 按空闲内存分配缓冲区并创建bflushd。需要在kthread_create可用之后调用。
+void
+binit(void)
+{
+  uint64 nbuf = kfree_bytes() / 8 / BSIZE;
+  int nbucket;
+  uchar *data;
+
+  // 取2的幂, kmalloc不浪费
+  if(nbuf > NBUF_MAX)
+    nbuf = NBUF_MAX;
+  while(nbuf & (nbuf - 1))
+    nbuf &= nbuf - 1;
+  if(nbuf < NBUF_MIN)
+    nbuf = NBUF_MIN;
+  for(nbucket = NBUCKET_MIN; nbucket < nbuf / 4 && nbucket < NBUCKET_MAX; nbucket *= 2)
+    ;
+
+  bcache.buf = kmalloc(nbuf * sizeof(struct buf));
+  data = kmalloc(nbuf * BSIZE);
+  bcache.buckets = kmalloc(nbucket * sizeof(struct bucket));
+  if(bcache.buf == 0 || data == 0 || bcache.buckets == 0)
+    panic("binit");
+  bcache.nbuf = nbuf;
+  bcache.nbucket = nbucket;
+
+  initlock(&bcache.clock_lock, "bcache");
+  initlock(&bcache.dirty_lock, "bcache.dirty");
+  lst_init(&bcache.dirty);
+  for(int i = 0; i < nbucket; i++){
+    initlock(&bcache.buckets[i].lock, "bcache.bucket");
+    lst_init(&bcache.buckets[i].head);
+  }
+  for(int i = 0; i < nbuf; i++){
+    struct buf *b = &bcache.buf[i];
+    b->flags = 0;
+    b->refcnt = 0;
+    b->bucket = -1;
+    b->data = data + i * BSIZE;
+  }
+
+  timer_setup(&bcache.flush_timer, flush_timer_fn, 0);
+  if((bcache.flushd = kthread_create(bflushd_thread, 0, "bflushd")) == 0)
+    panic("binit");
+  printf("bio: %d buffers, %d buckets\n", bcache.nbuf, bcache.nbucket);
+}
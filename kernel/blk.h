@@ -0,0 +1,33 @@
+#ifndef __BLK_H
+#define __BLK_H
+
+#include "types.h"
+#include "list.h"
+
+// 块设备请求 (virtio_blk.c)。
+//
+// 一个请求读写从sector开始的连续扇区, 内存一侧可以是最多BLK_MAX_SEGS个
+// 不连续的段(scatter-gather)。请求提交后异步完成: 完成时在TASKLET_SOFTIRQ中
+// 设置status和done, 然后调用end_io; end_io为0时唤醒在请求上睡眠的进程。
+
+#define BLK_SECTOR_SIZE 512
+#define BLK_MAX_SEGS 8
+
+struct blk_seg {
+  void *addr;              // 内核地址(即物理地址)
+  uint32 len;              // 字节数, 所有段之和是扇区大小的整数倍
+};
+
+struct blk_req {
+  uint64 sector;           // 起始扇区
+  int write;               // 1为写, 0为读
+  int nseg;
+  struct blk_seg seg[BLK_MAX_SEGS];
+  int status;              // 完成后有效: 0成功, -1失败
+  volatile int done;
+  void (*end_io)(struct blk_req *r); // 完成回调, 在软中断中调用, 不能睡眠
+  void *private;           // 提交者使用
+  struct list link;        // 驱动内部: 等待描述符的队列
+};
+
+#endif // __BLK_H
@@ -0,0 +1,28 @@
+#ifndef __BUF_H
+#define __BUF_H
+
+#include "types.h"
+#include "list.h"
+
+// 块缓存 (bio.c)
+
+#define BSIZE 1024 // 块大小, 两个扇区
+
+#define B_VALID 0x1  // 已从磁盘读入
+#define B_DIRTY 0x2  // 修改过, 需要写回
+#define B_BUSY  0x4  // 被某个持有者锁住, 或者正在进行I/O
+#define B_RA    0x8  // 由预读读入, 还没有被访问过
+#define B_REF   0x10 // CLOCK的访问位
+
+struct buf {
+  int flags;
+  uint dev;
+  uint blockno;
+  int refcnt;            // 引用数, 不为0时不会被换出
+  int bucket;            // 所在的哈希桶, -1表示不在哈希表中
+  struct list hash_link; // 哈希桶中的链表节点
+  struct list dirty_link; // 脏缓冲区链表中的节点, 由dirty_lock保护
+  uchar *data;           // BSIZE字节
+};
+
+#endif // __BUF_H
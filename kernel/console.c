@@ -6,17 +6,52 @@
 //   Control-H -- 退格
 //   Control-U -- 删除整行
 //   Control-D -- 文件结束
-//   Control-P -- 打印进程列表
+//   Control-P -- 打印进程列表和调度、中断、锁的统计
+//   Control-B -- 测量进程创建/回收的速度
 //
 
 #include "types.h"
+#include "paging.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "workqueue.h"
 #include "global_func.h"
 
+#define INPUT_BUF_SIZE 128
+#define C(x) ((x) - '@') // Control-x
+#define BACKSPACE 0x100
+
+// 控制台输入缓冲区。uart_intr把收到的字节交给console_intr,
+// 编辑完一整行(或^D)之后才唤醒在console_read中睡眠的读者,
+// 等待输入时不占用CPU。
+static struct {
+  struct spinlock lock;
+  char buf[INPUT_BUF_SIZE];
+  uint r; // 读者的读取位置
+  uint w; // 已提交(读者可见)的位置
+  uint e; // 正在编辑的位置
+} cons;
+
+static struct work dump_work; // ^P的调试输出放到worker线程中打印
+static struct work trace_work; // ^T关闭跟踪时输出跟踪缓冲区
+static struct work prof_work;  // ^R停止采样时输出样本
+static struct work bench_work; // ^B运行proc_bench
+
 // 输出单个字符到 UART
 void console_putc(char c) {
     uart_putc(c);
 }
 
+// 输出n个字节, 换行前补回车
+void console_write(const char *s, int n) {
+    for (int i = 0; i < n; i++) {
+        if (s[i] == '\n') {
+            console_putc('\r');
+        }
+        console_putc(s[i]);
+    }
+}
+
 // 输出字符串到 UART
 void console_puts(const char *s) {
     while (*s) {
@@ -26,3 +61,139 @@ void console_puts(const char *s) {
         console_putc(*s++);
     }
 }
+
+// 回显一个字符, 退格时擦掉前一个字符
+static void console_echo(int c) {
+    if (c == BACKSPACE) {
+        uart_putc('\b');
+        uart_putc(' ');
+        uart_putc('\b');
+    } else if (c == '\n') {
+        uart_putc('\r');
+        uart_putc('\n');
+    } else {
+        uart_putc(c);
+    }
+}
+
+// ^P: 打印进程列表和各种统计, 在worker线程中执行
+static void console_dump(struct work *w) {
+    procdump();
+    sched_stat_print();
+    irq_stat_print();
+    plic_stat_print();
+    lock_stat_print();
+    perf_stat_print();
+    virtio_blk_stat_print();
+    bio_stat_print();
+}
+
+static void console_trace_dump(struct work *w) {
+    trace_dump();
+}
+
+static void console_prof_dump(struct work *w) {
+    prof_dump();
+}
+
+static void console_bench(struct work *w) {
+    proc_bench(1000);
+}
+
+// 读取最多n个字节到用户地址dst, 读到一整行或文件结束时返回。
+// 返回读到的字节数, 出错返回-1。
+int console_read(uint64 dst, int n) {
+    struct proc *p = myproc();
+    int target = n;
+    int c;
+    char cbuf;
+
+    // 关中断检查缓冲区再睡眠, 中间不会错过console_intr的唤醒
+    push_off();
+    acquire(&cons.lock);
+    while (n > 0) {
+        while (cons.r == cons.w) {
+            release(&cons.lock);
+            sleep(&cons.r);
+            acquire(&cons.lock);
+        }
+        c = cons.buf[cons.r++ % INPUT_BUF_SIZE];
+
+        if (c == C('D')) {
+            // 文件结束。已经读到数据时留给下一次读取, 让它返回0
+            if (n < target)
+                cons.r--;
+            break;
+        }
+        cbuf = c;
+        if (copyout(p->pagetable, dst, &cbuf, 1) < 0)
+            break;
+        dst++;
+        n--;
+        if (c == '\n')
+            break;
+    }
+    release(&cons.lock);
+    pop_off();
+    return target - n;
+}
+
+// 接收到一个字节, 在UART中断中调用
+void console_intr(int c) {
+    acquire(&cons.lock);
+    switch (c) {
+    case C('P'):
+        schedule_work(&dump_work);
+        break;
+    case C('T'): // 开启所有跟踪点; 再按一次关闭并输出
+        if (trace_set(~0U) != 0) {
+            trace_set(0);
+            schedule_work(&trace_work);
+        }
+        break;
+    case C('R'): // 开始带调用栈的采样; 再按一次停止并输出
+        if (prof_stop())
+            schedule_work(&prof_work);
+        else
+            prof_start(0, 1);
+        break;
+    case C('B'):
+        schedule_work(&bench_work);
+        break;
+    case C('U'): // 删除整行
+        while (cons.e != cons.w &&
+               cons.buf[(cons.e - 1) % INPUT_BUF_SIZE] != '\n') {
+            cons.e--;
+            console_echo(BACKSPACE);
+        }
+        break;
+    case C('H'): // 退格
+    case '\x7f': // Delete
+        if (cons.e != cons.w) {
+            cons.e--;
+            console_echo(BACKSPACE);
+        }
+        break;
+    default:
+        if (c != 0 && cons.e - cons.r < INPUT_BUF_SIZE) {
+            c = (c == '\r') ? '\n' : c;
+            console_echo(c);
+            cons.buf[cons.e++ % INPUT_BUF_SIZE] = c;
+            // 一整行、文件结束或缓冲区已满时提交给读者
+            if (c == '\n' || c == C('D') || cons.e - cons.r == INPUT_BUF_SIZE) {
+                cons.w = cons.e;
+                wakeup(&cons.r);
+            }
+        }
+        break;
+    }
+    release(&cons.lock);
+}
+
+void console_init(void) {
+    initlock(&cons.lock, "cons");
+    work_init(&dump_work, console_dump);
+    work_init(&trace_work, console_trace_dump);
+    work_init(&prof_work, console_prof_dump);
+    work_init(&bench_work, console_bench);
+}
@@ -0,0 +1,70 @@
+// 浮点状态的惰性切换 (fpu.c)
+//
+// 每个进程被调度时sstatus.FS都是Off, 第一条浮点指令触发非法指令异常,
+// 这时才恢复它的浮点寄存器并把FS设为Clean。切换出去时只有FS为Dirty
+// (确实写过浮点寄存器) 才保存。从不使用浮点的进程没有任何额外开销。
+//
+// cpu->fp_owner记录浮点寄存器中是谁的状态: 如果一个进程切换出去后
+// 没有别的进程用过浮点, 再次使用时连恢复也可以省掉。
+
+#include "types.h"
+#include "paging.h"
+#include "proc.h"
+#include "global_func.h"
+
+void fp_save(struct fpstate *);
+void fp_restore(struct fpstate *);
+
+static struct fpstate fp_zero; // 从未使用过浮点的进程的初始状态
+
+static inline void
+fs_set(uint64 fs)
+{
+  w_sstatus((r_sstatus() & ~SSTATUS_FS) | fs);
+}
+
+// 进程p即将切换出去。FS为Dirty时保存浮点寄存器, 然后关闭浮点单元。
+void
+fp_switch_out(struct proc *p)
+{
+  uint64 fs = r_sstatus() & SSTATUS_FS;
+
+  if(fs == SSTATUS_FS_OFF)
+    return;
+  if(fs == SSTATUS_FS_DIRTY && p->state != ZOMBIE){
+    fp_save(&p->fpstate);
+    p->fp_used = 1;
+  }
+  fs_set(SSTATUS_FS_OFF);
+}
+
+// 非法指令异常时调用。如果是FS为Off时的浮点指令, 装入当前进程的
+// 浮点状态并返回1, 异常返回后重新执行该指令; 否则返回0。
+// 不是浮点指令的话重新执行时FS已打开, 会再次以普通非法指令报告。
+int
+fp_trap(void)
+{
+  struct cpu *c = mycpu();
+  struct proc *p = c->proc;
+
+  if(p == 0 || (r_sstatus() & SSTATUS_FS) != SSTATUS_FS_OFF)
+    return 0;
+
+  fs_set(SSTATUS_FS_INITIAL);
+  if(c->fp_owner != p){
+    // 从未用过浮点的进程装入全0, 不能看到上一个进程留下的值
+    fp_restore(p->fp_used ? &p->fpstate : &fp_zero);
+    c->fp_owner = p;
+  }
+  fs_set(SSTATUS_FS_CLEAN);
+  return 1;
+}
+
+// 进程p被释放, 它的proc结构体可能被复用, 不能再被当作fp_owner
+void
+fp_release(struct proc *p)
+{
+  if(mycpu()->fp_owner == p)
+    mycpu()->fp_owner = 0;
+  p->fp_used = 0;
+}
@@ -0,0 +1,125 @@
+// 用户态的等待/唤醒原语 (futex.c)
+//
+// 无竞争时用户态只用原子指令操作锁变量, 不陷入内核;
+// 有竞争时才调用futex_wait睡眠, 由持有者futex_wake唤醒。
+// 等待者按锁变量的物理地址挂在哈希表的桶上, 映射到不同虚拟地址的
+// 同一块共享内存也能互相唤醒。
+//
+// 单核上关中断就足以保证"检查值"与"挂上等待队列"之间不会丢失唤醒。
+
+#include "types.h"
+#include "paging.h"
+#include "memlayout.h"
+#include "proc.h"
+#include "timer.h"
+#include "global_func.h"
+
+#define FUTEX_HASH_BITS 6
+#define FUTEX_HASH_SIZE (1 << FUTEX_HASH_BITS)
+
+// 一个等待者, 在futex_wait的栈上
+struct futex_waiter {
+  struct list link;   // 桶中的链表节点
+  uint64 key;         // 锁变量的物理地址
+  struct proc *proc;
+  int woken;          // 是否已被futex_wake唤醒
+};
+
+static struct list futex_queues[FUTEX_HASH_SIZE];
+
+static struct list *
+futex_bucket(uint64 key)
+{
+  // 锁变量至少4字节对齐, 低2位没有信息
+  return &futex_queues[((key >> 2) * 0x9E3779B97F4A7C15UL) >> (64 - FUTEX_HASH_BITS)];
+}
+
+// 用户地址uaddr对应的物理地址, 地址非法或未对齐时返回0
+static uint64
+futex_key(struct proc *p, uint64 uaddr)
+{
+  uint64 pa;
+
+  if(uaddr & 3)
+    return 0;
+  if((pa = walkaddr(p->pagetable, PGROUNDDOWN(uaddr))) == 0)
+    return 0;
+  return pa + (uaddr & (PGSIZE - 1));
+}
+
+// 如果*uaddr仍等于val就睡眠, 直到被futex_wake唤醒或超过timeout_us微秒
+// (0表示不超时)。返回0表示被唤醒, -1表示地址非法或值已改变, -2表示超时。
+int
+futex_wait(uint64 uaddr, uint32 val, uint64 timeout_us)
+{
+  struct proc *p = myproc();
+  struct futex_waiter w;
+  uint32 cur;
+  int ret;
+
+  w.key = futex_key(p, uaddr);
+  if(w.key == 0)
+    return -1;
+  w.proc = p;
+  w.woken = 0;
+
+  push_off();
+  // 关中断后读值: 读到val之后, 唤醒者一定能在桶中看到我们
+  cur = *(uint32 *)w.key;
+  if(cur != val){
+    pop_off();
+    return -1;
+  }
+  lst_push_back(futex_bucket(w.key), &w.link);
+  p->timedout = 0;
+  if(timeout_us)
+    timer_add(&p->timer, r_time() + US2CYCLES(timeout_us));
+  while(!w.woken && !p->timedout){
+    p->state = SLEEPING;
+    sched();
+  }
+  timer_cancel(&p->timer);
+  if(w.woken){
+    ret = 0;
+  } else {
+    lst_remove(&w.link);
+    ret = -2;
+  }
+  pop_off();
+  return ret;
+}
+
+// 唤醒最多n个在uaddr上等待的进程, 返回唤醒的个数
+int
+futex_wake(uint64 uaddr, int n)
+{
+  struct list *bucket, *e, *next;
+  struct futex_waiter *w;
+  uint64 key;
+  int woken = 0;
+
+  if((key = futex_key(myproc(), uaddr)) == 0)
+    return -1;
+  bucket = futex_bucket(key);
+
+  push_off();
+  for(e = bucket->next; e != bucket && woken < n; e = next){
+    next = e->next;
+    w = lst_entry(e, struct futex_waiter, link);
+    if(w->key != key)
+      continue;
+    lst_remove(&w->link);
+    w->woken = 1;
+    wakeup_proc(w->proc);
+    woken++;
+  }
+  pop_off();
+  return woken;
+}
+
+void
+futex_init(void)
+{
+  for(int i = 0; i < FUTEX_HASH_SIZE; i++)
+    lst_init(&futex_queues[i]);
+}
@@ -1,16 +1,82 @@
 #include "types.h"
 #include "proc.h"
+#include "workqueue.h"
+#include "softirq.h"
+#include "spinlock.h"
+#include "trace.h"
 
 // main.c
 void main();
 
 void uart_puts(const char *s);
 void uart_putc(int c);
+void uart_putc_sync(int c);
+void uart_intr(void);
 void panic(const char *s);
 int uart_getc(void);
 void uart_init(void);
 int printf(char *fmt, ...);
+int snprintf(char *buf, int size, const char *fmt, ...);
 void clear_screen(void);
+void console_write(const char *s, int n);
+void console_init(void);
+void console_intr(int c);
+int console_read(uint64 dst, int n);
+
+// klog.c
+void klog_write(const char *s, int n);
+void klog_flush(void);
+void klog_wake(void);
+void klog_panic_flush(void);
+void klog_init(void);
+
+// trace.c
+uint32 trace_set(uint32 mask);
+void trace_reset(void);
+void trace_dump(void);
+
+// prof.c
+void prof_sample(uint64 pc, int user, uint64 fp);
+void prof_tick(uint64 pc, int user, uint64 fp);
+int prof_start(uint64 period_us, int callchain);
+int prof_stop(void);
+void prof_dump(void);
+
+// perf.c
+void perf_switch(struct proc *p);
+int perf_open(uint64 event, uint64 period);
+int perf_close(int s);
+void perf_release(struct proc *p);
+int64 perf_read(int s);
+void perf_overflow_intr(uint64 pc, int user, uint64 fp);
+void perf_stat_print(void);
+void perf_init(void);
+
+// virtio_blk.c
+struct blk_req;
+void virtio_blk_init(void);
+void virtio_blk_submit(struct blk_req **reqs, int n);
+int virtio_blk_rw(struct blk_req *r);
+uint64 virtio_blk_capacity(void);
+void virtio_blk_stat_print(void);
+
+// bio.c
+struct buf;
+void binit(void);
+struct buf* bread(uint dev, uint blockno);
+void bwrite(struct buf *b);
+void brelse(struct buf *b);
+void bsync(void);
+void bio_stat_print(void);
+
+// plic.c
+void plic_register(int irq, int priority, void (*handler)(void));
+void plic_set_priority(int irq, int priority);
+void plic_inithart(void);
+int plic_claim(void);
+void plic_complete(int irq);
+void plic_dispatch(void);
+void plic_stat_print(void);
 
 // kalloc.c
 void pmm_init();
@@ -20,6 +86,8 @@ void* alloc_pages(int order);   // 新增: 分配 2^order 个连续页, 返回
 // small object allocator
 void* kmalloc(uint64 size);
 void kfree(void* p);
+void kalloc_register_shrinker(int (*shrink)(int));
+uint64 kfree_bytes(void);
 void bd_print(); // 打印伙伴系统状态, 仅调试用
 
 // vm.c
@@ -27,18 +95,152 @@ void kvm_init();
 void kvm_init_hart();
 pagetable_t proc_pagetable(struct proc *p);
 void uvminit(pagetable_t, uchar *, uint);
+int mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm);
+uint64 walkaddr(pagetable_t pagetable, uint64 va);
+int copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len);
+int copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len);
+uint64 uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz);
+
+// syscall.c
+int syscall(void);
+uint64 argraw(int n);
+int argint(int n);
+uint64 argaddr(int n);
+
+// vdso.c
+void vdso_init(void);
+int vdso_map(pagetable_t pagetable);
+void vdso_settime(uint64 ns);
+uint64 vdso_gettime_kernel(void);
 
 // trap.c
 void trapinithart(void);
 void kerneltrap();
+void usertrap(void);
+void usertrapret(void);
+void csr_probe_start(void);
+int csr_probe_end(void);
+
+// timer.c
+void timer_init(void);
+void timer_set_timeslice(uint64 us);
+void timer_rearm(void);
+void timer_add(struct timer *t, uint64 expires);
+int timer_cancel(struct timer *t);
+void timer_start_slice(void);
+int timer_intr(void);
+void timer_idle(void);
+
+// rcu.c
+void rcu_init(void);
+void rcu_start(void);
+void rcu_read_lock(void);
+void rcu_read_unlock(void);
+int rcu_read_locked(void);
+void rcu_qs(void);
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *));
+void synchronize_rcu(void);
+
+// softirq.c
+void softirq_init(void);
+void open_softirq(int nr, void (*fn)(void));
+void raise_softirq(int nr);
+void irq_enter(void);
+void irq_exit(void);
+int in_softirq(void);
+void irqoff_account(uint64 t, uint64 ra);
+void tasklet_schedule(struct tasklet *t);
+void irq_stat_print(void);
+
+// fpu.c
+void fp_switch_out(struct proc *p);
+int fp_trap(void);
+void fp_release(struct proc *p);
+
+// wait.c
+void wait_init(void);
+void waitq_sleep(struct wait_queue *wq, int exclusive);
+int wake_up(struct wait_queue *wq, int nr);
+void sleep(void *chan);
+void sleep_exclusive(void *chan);
+int wakeup(void *chan);
+int wakeup_one(void *chan);
+
+// futex.c
+void futex_init(void);
+int futex_wait(uint64 uaddr, uint32 val, uint64 timeout_us);
+int futex_wake(uint64 uaddr, int n);
+
+// schedstat.c
+void sched_stat_enqueue(struct proc *p, int wakeup);
+void sched_stat_dispatch(struct proc *p, int direct);
+void sched_stat_out(struct proc *p);
+void sched_stat_idle(uint64 t);
+int sched_stat_read(uint64 addr);
+int sched_stat_read_proc(int pid, uint64 addr);
+void sched_stat_print(void);
+
+// ipc.c
+int ipc_send(int dest);
+int ipc_call(int dest);
+int ipc_recv(int from);
+int ipc_reply(int dest);
+int ipc_replyrecv(int dest);
+int ipc_send_nowait(struct proc *from, int dest, uint64 *msg);
+void ipc_exit(struct proc *p);
+
+// uring.c
+void uring_init(void);
+int uring_setup(int flags);
+int uring_enter(int to_submit, int min_complete, int flags);
+void uring_exit(struct proc *p);
+void uring_free(struct proc *p);
 
 // proc.c
 void proc_init(void);
 void user_init(void);
 struct proc* alloc_proc(void);
+void free_proc(struct proc *p);
+int proc_cache_shrink(int n);
+void proc_bench(int n);
+struct proc* find_proc(int pid);
+void exit(int status);
+int64 growproc(struct proc *p, uint64 n);
+struct proc* kthread_create(void (*fn)(void *), void *arg, char *name);
 void scheduler(void);
+void sched(void);
+void proc_switch_to(struct proc *next);
+void yield(void);
+void yield_preempt(void);
+void wakeup_proc(struct proc *p);
+void sleep_until(uint64 deadline);
+void procdump(void);
+struct cpu* mycpu(void);
+struct proc* myproc(void);
 void swtch(struct context*, struct context*);
 
+// spinlock.c
+void initlock(struct spinlock *lk, char *name);
+void acquire(struct spinlock *lk);
+void release(struct spinlock *lk);
+int holding(struct spinlock *lk);
+void push_off(void);
+void pop_off(void);
+void lock_stat_print(void);
+
 // string.c
 void* memset(void*, int, uint);
 void* memmove(void*, const void*, uint);
+void* memcpy(void*, const void*, uint);
+void zero_page(void *pa);
+void copy_page(void *dst, const void *src);
+void string_init(void);
+char* safestrcpy(char*, const char*, int);
+int strlen(const char*);
+
+// workqueue.c
+void workqueue_init(void);
+struct workqueue* workqueue_create(char *name, int nworkers);
+int queue_work(struct workqueue *wq, struct work *w);
+int schedule_work(struct work *w);
+int cancel_work(struct work *w);
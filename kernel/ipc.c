@@ -0,0 +1,276 @@
+// 同步IPC (ipc.c)
+//
+// L4风格的send/recv/call/reply。消息是IPC_MSG_WORDS个字,
+// 发送方从自己的a1-a4中取出, 直接写进接收方trapframe的a1-a4,
+// 不经过内存拷贝。
+//
+// 客户端call时服务端已经在recv, 或服务端replyrecv时客户端在等待回复,
+// 一方阻塞而另一方正好可以运行, 这时用proc_switch_to直接切换过去,
+// 不经过运行队列和调度器循环, 对方继承剩余的时间片。
+//
+// 对方还没有准备好时, 发送方挂在接收方的ipc_sendq上睡眠。
+// 消息送达但还在等待回复的调用方也留在服务端的ipc_sendq上,
+// 这样服务端退出时可以找到并唤醒所有和它相关的进程。
+
+#include "types.h"
+#include "proc.h"
+#include "ipc.h"
+#include "global_func.h"
+
+// 把msg交给to, 并记录发送方。调用者需已关中断。
+static void
+ipc_deliver(struct proc *to, int from, uint64 *msg)
+{
+  struct trapframe *tf = to->trapframe;
+
+  tf->a1 = msg[0];
+  tf->a2 = msg[1];
+  tf->a3 = msg[2];
+  tf->a4 = msg[3];
+  to->ipc_from = from;
+}
+
+// 当前进程的a1-a4
+static void
+ipc_msg_current(uint64 *msg)
+{
+  struct trapframe *tf = myproc()->trapframe;
+
+  msg[0] = tf->a1;
+  msg[1] = tf->a2;
+  msg[2] = tf->a3;
+  msg[3] = tf->a4;
+}
+
+// 睡眠直到ipc_state变为IPC_NONE。
+// 如果next不为0, 直接切换到它而不是回到调度器。调用者需已push_off一层。
+static void
+ipc_block(struct proc *next)
+{
+  struct proc *p = myproc();
+
+  p->state = SLEEPING;
+  // next被其他途径唤醒时已经在运行队列上, 只能正常调度
+  if(next && next->state == SLEEPING)
+    proc_switch_to(next);
+  else
+    sched();
+  while(p->ipc_state != IPC_NONE){
+    p->state = SLEEPING;
+    sched();
+  }
+}
+
+// 从ipc_sendq中取出一个from(0表示任意)发来的消息交给当前进程。
+// 没有时返回0。调用者需已关中断。
+static struct proc *
+ipc_take(int from)
+{
+  struct proc *p = myproc();
+  struct list *e;
+  struct proc *s;
+
+  for(e = p->ipc_sendq.next; e != &p->ipc_sendq; e = e->next){
+    s = lst_entry(e, struct proc, ipc_link);
+    if(s->ipc_state != IPC_SENDING || (from && s->pid != from))
+      continue;
+    ipc_deliver(p, s->pid, s->ipc_msg);
+    if(s->ipc_partner){
+      // call: 留在队列上等待回复
+      s->ipc_state = IPC_CALLING;
+    } else {
+      lst_remove(&s->ipc_link);
+      s->ipc_state = IPC_NONE;
+      s->ipc_from = 0;
+      wakeup_proc(s);
+    }
+    return s;
+  }
+  return 0;
+}
+
+// 接收来自from(0表示任意)的消息, next不为0时阻塞时直接切换到它。
+// 返回发送方的PID, 消息在a1-a4中; 失败返回-1。调用者需已push_off一层。
+static int
+ipc_wait(int from, struct proc *next)
+{
+  struct proc *p = myproc();
+
+  if(ipc_take(from)){
+    if(next)
+      wakeup_proc(next);
+    return p->ipc_from;
+  }
+  p->ipc_state = IPC_RECEIVING;
+  p->ipc_partner = from;
+  p->ipc_from = -1;
+  ipc_block(next);
+  return p->ipc_from;
+}
+
+// 发送msg给dest。call为1时送达后继续等待dest的回复。
+// 返回0, 失败返回-1。
+static int
+ipc_send_msg(int dest, uint64 *msg, int call)
+{
+  struct proc *p = myproc();
+  struct proc *d;
+  int ret;
+
+  // 关中断也是RCU读侧临界区, 保证d在使用期间不被回收
+  push_off();
+  d = find_proc(dest);
+  if(d == 0 || d == p || d->kfn || d->state == ZOMBIE){
+    pop_off();
+    return -1;
+  }
+  if(d->ipc_state == IPC_RECEIVING &&
+     (d->ipc_partner == 0 || d->ipc_partner == p->pid)){
+    // 接收方已经在等待
+    ipc_deliver(d, p->pid, msg);
+    d->ipc_state = IPC_NONE;
+    if(!call){
+      wakeup_proc(d);
+      pop_off();
+      return 0;
+    }
+    p->ipc_state = IPC_CALLING;
+    p->ipc_partner = dest;
+    p->ipc_from = -1;
+    lst_push_back(&d->ipc_sendq, &p->ipc_link);
+    ipc_block(d);
+  } else {
+    for(int i = 0; i < IPC_MSG_WORDS; i++)
+      p->ipc_msg[i] = msg[i];
+    p->ipc_state = IPC_SENDING;
+    p->ipc_partner = call ? dest : 0;
+    p->ipc_from = -1;
+    lst_push_back(&d->ipc_sendq, &p->ipc_link);
+    ipc_block(0);
+  }
+  ret = p->ipc_from < 0 ? -1 : 0;
+  pop_off();
+  return ret;
+}
+
+// 回复正在等待当前进程回复的dest, 返回dest, 失败返回0。调用者需已关中断。
+static struct proc *
+ipc_reply_msg(int dest, uint64 *msg)
+{
+  struct proc *p = myproc();
+  struct proc *d;
+
+  if((d = find_proc(dest)) == 0)
+    return 0;
+  if(d->ipc_state != IPC_CALLING || d->ipc_partner != p->pid)
+    return 0;
+  lst_remove(&d->ipc_link);
+  ipc_deliver(d, p->pid, msg);
+  d->ipc_state = IPC_NONE;
+  return d;
+}
+
+// send(dest, m0..m3): 阻塞直到dest接收
+int
+ipc_send(int dest)
+{
+  uint64 msg[IPC_MSG_WORDS];
+
+  ipc_msg_current(msg);
+  return ipc_send_msg(dest, msg, 0);
+}
+
+// call(dest, m0..m3): 发送并等待dest的回复, 回复在a1-a4中
+int
+ipc_call(int dest)
+{
+  uint64 msg[IPC_MSG_WORDS];
+
+  ipc_msg_current(msg);
+  return ipc_send_msg(dest, msg, 1);
+}
+
+// recv(from): 接收来自from(0表示任意)的消息, 返回发送方PID
+int
+ipc_recv(int from)
+{
+  int ret;
+
+  push_off();
+  ret = ipc_wait(from, 0);
+  pop_off();
+  return ret;
+}
+
+// reply(dest, m0..m3): 回复dest, 不阻塞
+int
+ipc_reply(int dest)
+{
+  uint64 msg[IPC_MSG_WORDS];
+  struct proc *d;
+
+  ipc_msg_current(msg);
+  push_off();
+  if((d = ipc_reply_msg(dest, msg)) != 0)
+    wakeup_proc(d);
+  pop_off();
+  return d ? 0 : -1;
+}
+
+// replyrecv(dest, m0..m3): 服务端的快速路径。回复dest(dest为0时不回复),
+// 然后接收下一个请求; 没有新请求时直接切换到刚被回复的客户端。
+// 返回下一个请求的发送方PID, 回复失败返回-1。
+int
+ipc_replyrecv(int dest)
+{
+  uint64 msg[IPC_MSG_WORDS];
+  struct proc *d = 0;
+  int ret;
+
+  ipc_msg_current(msg);
+  push_off();
+  if(dest && (d = ipc_reply_msg(dest, msg)) == 0){
+    pop_off();
+    return -1;
+  }
+  ret = ipc_wait(0, d);
+  pop_off();
+  return ret;
+}
+
+// 发送msg给dest但不阻塞, dest没有在等待时返回-1。
+// 用于uring等不能睡眠的上下文, 发送方为from。
+int
+ipc_send_nowait(struct proc *from, int dest, uint64 *msg)
+{
+  struct proc *d;
+  int ret = -1;
+
+  push_off();
+  d = find_proc(dest);
+  if(d && d != from && !d->kfn && d->ipc_state == IPC_RECEIVING &&
+     (d->ipc_partner == 0 || d->ipc_partner == from->pid)){
+    ipc_deliver(d, from->pid, msg);
+    d->ipc_state = IPC_NONE;
+    wakeup_proc(d);
+    ret = 0;
+  }
+  pop_off();
+  return ret;
+}
+
+// 进程退出时调用: 所有等它接收或回复的进程以失败返回
+void
+ipc_exit(struct proc *p)
+{
+  struct proc *s;
+
+  push_off();
+  while(!lst_empty(&p->ipc_sendq)){
+    s = lst_entry(lst_pop(&p->ipc_sendq), struct proc, ipc_link);
+    s->ipc_state = IPC_NONE;
+    s->ipc_from = -1;
+    wakeup_proc(s);
+  }
+  pop_off();
+}
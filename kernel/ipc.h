@@ -0,0 +1,13 @@
+#ifndef __IPC_H
+#define __IPC_H
+
+// 同步IPC (ipc.c)。短消息放在寄存器a1-a4中传递。
+#define IPC_MSG_WORDS 4
+
+// proc->ipc_state
+#define IPC_NONE      0
+#define IPC_SENDING   1 // 在目标的ipc_sendq上等待对方接收
+#define IPC_RECEIVING 2 // 等待消息, ipc_partner为0表示接收任何进程
+#define IPC_CALLING   3 // 消息已送达, 在对方的ipc_sendq上等待回复
+
+#endif // __IPC_H
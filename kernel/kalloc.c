@@ -2,26 +2,13 @@
 #include "memlayout.h"
 #include "global_func.h"
 #include "list.h"
+#include "spinlock.h"
 
 extern char end[]; // 由链接器定义, 指向内核数据段的末尾
 
 // 空闲块的链表节点直接使用块自身的内存(侵入式链表)
 // 链表是双向循环链表 (list.c/list.h)
 
-// 简易的自旋锁占位符, 当前版本是空实现, 不支持多核并发
-struct spinlock
-{
-  int dummy;
-};
-static inline void initlock(struct spinlock *lk, const char *name)
-{
-  (void)lk;
-  (void)name;
-}
-static inline void acquire(struct spinlock *lk) { (void)lk; }
-static inline void release(struct spinlock *lk) { (void)lk; }
-
-
 static int nsizes; // 块大小的种类数量 (k=0..nsizes-1)
 
 #define LEAF_SIZE 128                                    // 最小块大小, 16字节
@@ -45,6 +32,12 @@ static void *bd_base;           // 伙伴系统管理的内存区域的基地址
 static struct spinlock bd_lock; // 保护伙伴系统的锁
 static uint64 freelist_bitmap;  // 新增: 用于快速查找非空闲链表的位图
 
+// 内存不足时调用的回收函数, 由持有可丢弃缓存的子系统注册。
+// shrink(n)尝试释放n页左右的内存, 返回实际释放的页数。
+#define NSHRINKER 8
+static int (*shrinkers[NSHRINKER])(int);
+static int nshrinker;
+
 // ===== 位操作辅助函数 =====
 
 #define bit_isset(array, index) ((((char *)(array))[(index) / 8] & (1 << ((index) % 8))) != 0)
@@ -305,8 +298,39 @@ static void bd_init(void *base, void *end)
   }
 }
 
+// 注册一个内存回收函数
+void kalloc_register_shrinker(int (*shrink)(int))
+{
+  if (nshrinker >= NSHRINKER)
+    panic("kalloc_register_shrinker");
+  shrinkers[nshrinker++] = shrink;
+}
+
+// 依次调用回收函数, 返回释放的总页数
+static int bd_shrink(uint64 nbytes)
+{
+  int want = (nbytes + PGSIZE - 1) / PGSIZE;
+  int freed = 0;
+  for (int i = 0; i < nshrinker && freed < want; i++)
+    freed += shrinkers[i](want - freed);
+  return freed;
+}
+
+static void *bd_malloc(uint64 nbytes);
+
 // 分配nbytes字节的内存
+// 伙伴系统没有足够大的空闲块时, 先让各个缓存释放内存再重试一次
 void *kmalloc(uint64 nbytes)
+{
+  void *p = bd_malloc(nbytes);
+  if (p == 0 && bd_shrink(nbytes) > 0)
+    p = bd_malloc(nbytes);
+  TRACE(TRACE_KMALLOC, nbytes, p, 0);
+  return p;
+}
+
+// 从伙伴系统中分配nbytes字节的内存
+static void *bd_malloc(uint64 nbytes)
 {
   int fk, k;
 
@@ -314,11 +338,11 @@ void *kmalloc(uint64 nbytes)
   if (nbytes < LEAF_SIZE)
     nbytes = LEAF_SIZE;
 
-  acquire(&bd_lock);
-
-  // 1. 找到能满足nbytes的最小的阶fk
+  // 1. 找到能满足nbytes的最小的阶fk, 不访问共享状态, 放在锁外
   fk = firstk(nbytes);
 
+  acquire(&bd_lock);
+
   // 2. 使用位图快速查找有空闲块的最小的阶k (k >= fk)
   int bit = find_first_set_ge(freelist_bitmap, fk);
   k = (bit > 0) ? (bit - 1) : nsizes;
@@ -369,6 +393,7 @@ void free_page(void *vp)
   int k;
   char *p = (char *)vp;
 
+  TRACE(TRACE_FREE_PAGE, p, 0, 0);
   acquire(&bd_lock);
 
   // 1. 确定要释放的块p的阶k
@@ -416,6 +441,25 @@ void pmm_init()
   }
 }
 
+// 伙伴系统中空闲内存的字节数, 遍历空闲链表, 用于按可用内存确定缓存的大小
+uint64 kfree_bytes(void)
+{
+  uint64 n = 0;
+
+  acquire(&bd_lock);
+  for (int k = 0; k < nsizes; k++)
+    for (struct list *e = bd_sizes[k].free.next; e != &bd_sizes[k].free; e = e->next)
+      n += BLK_SIZE(k);
+  release(&bd_lock);
+  return n;
+}
+
+// 释放kmalloc分配的内存, 块大小由伙伴系统的split位图确定
+void kfree(void *p)
+{
+  free_page(p);
+}
+
 // 分配单个物理页
 void *alloc_page()
 {
@@ -0,0 +1,209 @@
+// 内核日志环 (klog.c)
+//
+// printf把格式化好的文本作为一条记录追加到这个字节环中, 由klogd线程
+// 异步写到控制台, 所以在调度器或陷入路径中打日志只需要几次内存写。
+//
+// 环是无锁多生产者的: 生产者用CAS推进head预留一段空间, 先写记录头的
+// 其余部分和正文, 最后用release写入记录头的pos字段提交。pos等于记录在
+// 环中的绝对位置, 消费者读到的pos与tail不相等说明这条记录还没有提交
+// (或者是上一圈留下的旧记录), 就停下来等待。生产者之间不互相等待,
+// 中断处理中的生产者可以打断进程上下文中写到一半的生产者。
+//
+// 环满时新记录被丢弃并计数, 不覆盖还没输出的记录。
+// panic时用klog_panic_flush把剩下的记录同步输出。
+//
+// 唤醒klogd要取等待队列的锁。在中断上半部或持有锁时写日志(例如在
+// wakeup内部)不能直接唤醒, 只设置klog_wake_pending, 由irq_exit或者
+// 最外层的pop_off在安全的地方补上唤醒。
+
+#include "types.h"
+#include "paging.h"
+#include "proc.h"
+#include "global_func.h"
+
+#define KLOG_SIZE 16384         // 必须是2的幂
+#define KLOG_ALIGN 8
+#define KLOG_MAXLEN 256         // 单条记录正文的最大长度, 与printf的缓冲区一致
+
+// 记录头, 后面紧跟len字节的正文, 整条记录按KLOG_ALIGN对齐
+struct klog_rec {
+  uint64 pos;                   // 记录的绝对位置, 最后写入, 表示已提交
+  uint64 time;                  // 写入时的time CSR
+  uint16 len;                   // 正文长度
+  uint16 hart;                  // 写入的hart
+  uint32 pad;
+};
+
+static char klog_buf[KLOG_SIZE] __attribute__((aligned(KLOG_ALIGN)));
+static uint64 klog_head;        // 下一条记录的位置, 生产者推进
+static uint64 klog_tail;        // 下一条要输出的记录, 消费者推进
+static uint64 klog_dropped;     // 因为环满而丢弃的记录数
+static int klog_flushing;       // 有消费者正在输出
+static int klogd_idle;          // klogd在睡眠, 需要唤醒
+int klog_wake_pending;          // 推迟的唤醒, 由klog_wake补上
+static struct proc *klogd;
+
+extern volatile int panicked;
+
+static void
+ring_write(uint64 pos, const void *src, int n)
+{
+  const char *s = src;
+  for(int i = 0; i < n; i++)
+    klog_buf[(pos + i) & (KLOG_SIZE - 1)] = s[i];
+}
+
+static void
+ring_read(uint64 pos, void *dst, int n)
+{
+  char *d = dst;
+  for(int i = 0; i < n; i++)
+    d[i] = klog_buf[(pos + i) & (KLOG_SIZE - 1)];
+}
+
+static inline uint64 *
+rec_pos(uint64 pos)
+{
+  return (uint64 *)&klog_buf[pos & (KLOG_SIZE - 1)];
+}
+
+static inline int
+rec_size(int len)
+{
+  return (sizeof(struct klog_rec) + len + KLOG_ALIGN - 1) & ~(KLOG_ALIGN - 1);
+}
+
+// 追加一条n字节的记录。不加锁, 不睡眠, 可以在任何上下文中调用。
+void
+klog_write(const char *s, int n)
+{
+  struct cpu *c = mycpu();
+  struct klog_rec r;
+  uint64 head;
+  int size;
+
+  if(n <= 0)
+    return;
+  if(panicked){
+    console_write(s, n);
+    return;
+  }
+  if(n > KLOG_MAXLEN)
+    n = KLOG_MAXLEN;
+  size = rec_size(n);
+
+  // 预留[head, head+size)
+  head = __atomic_load_n(&klog_head, __ATOMIC_RELAXED);
+  do {
+    if(head + size - __atomic_load_n(&klog_tail, __ATOMIC_ACQUIRE) > KLOG_SIZE){
+      __atomic_fetch_add(&klog_dropped, 1, __ATOMIC_RELAXED);
+      return;
+    }
+  } while(!__atomic_compare_exchange_n(&klog_head, &head, head + size, 0,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+  r.time = r_time();
+  r.len = n;
+  r.hart = c - cpus;
+  r.pad = 0;
+  // pos在偏移0处且8字节对齐, 不会跨过环的末尾
+  ring_write(head + sizeof(r.pos), (char *)&r + sizeof(r.pos), sizeof(r) - sizeof(r.pos));
+  ring_write(head + sizeof(r), s, n);
+  __atomic_store_n(rec_pos(head), head, __ATOMIC_RELEASE);
+
+  if(klogd == 0)
+    klog_flush();       // 启动早期没有klogd, 直接输出
+  else if(__atomic_load_n(&klogd_idle, __ATOMIC_ACQUIRE)){
+    if(c->in_irq || c->noff > 0)
+      __atomic_store_n(&klog_wake_pending, 1, __ATOMIC_RELEASE);
+    else
+      wakeup(&klogd);
+  }
+}
+
+// 补上推迟的klogd唤醒。调用者不在中断上半部, 也不持有锁。
+void
+klog_wake(void)
+{
+  if(__atomic_exchange_n(&klog_wake_pending, 0, __ATOMIC_ACQUIRE))
+    wakeup(&klogd);
+}
+
+// 取出一条已提交的记录, 正文复制到buf。没有记录时返回-1。
+// 调用者是唯一的消费者。
+static int
+klog_next(struct klog_rec *r, char *buf)
+{
+  uint64 tail = klog_tail;
+
+  if(tail == __atomic_load_n(&klog_head, __ATOMIC_ACQUIRE))
+    return -1;
+  if(__atomic_load_n(rec_pos(tail), __ATOMIC_ACQUIRE) != tail)
+    return -1;          // 已预留但还没提交
+  ring_read(tail, r, sizeof(*r));
+  ring_read(tail + sizeof(*r), buf, r->len);
+  __atomic_store_n(&klog_tail, tail + rec_size(r->len), __ATOMIC_RELEASE);
+  return r->len;
+}
+
+// 把已提交的记录全部写到控制台。已经有消费者在输出时直接返回。
+void
+klog_flush(void)
+{
+  struct klog_rec r;
+  char buf[KLOG_MAXLEN];
+  int n;
+
+  if(__atomic_exchange_n(&klog_flushing, 1, __ATOMIC_ACQUIRE))
+    return;
+  while((n = klog_next(&r, buf)) >= 0)
+    console_write(buf, n);
+  __atomic_store_n(&klog_flushing, 0, __ATOMIC_RELEASE);
+}
+
+// panic时调用: 不管是否有消费者在输出, 把剩下的记录带上时间戳同步输出。
+// 此时panicked已设置, uart_putc直接轮询发送。
+void
+klog_panic_flush(void)
+{
+  struct klog_rec r;
+  char buf[KLOG_MAXLEN];
+  int n;
+
+  if(klog_dropped){
+    n = snprintf(buf, sizeof(buf), "klog: %lu records dropped\n", klog_dropped);
+    console_write(buf, n);
+  }
+  while((n = klog_next(&r, buf)) >= 0){
+    uint64 us = r.time / 10;
+    char hdr[32];
+    int m = snprintf(hdr, sizeof(hdr), "[%5lu.%06lu h%d] ",
+                     us / 1000000, us % 1000000, r.hart);
+    console_write(hdr, m);
+    console_write(buf, n);
+  }
+}
+
+static void
+klogd_thread(void *arg)
+{
+  for(;;){
+    push_off();
+    while(klog_tail == __atomic_load_n(&klog_head, __ATOMIC_ACQUIRE)){
+      __atomic_store_n(&klogd_idle, 1, __ATOMIC_RELEASE);
+      sleep(&klogd);
+    }
+    __atomic_store_n(&klogd_idle, 0, __ATOMIC_RELEASE);
+    pop_off();
+    klog_flush();
+    yield();
+  }
+}
+
+// 创建klogd, 之后printf的输出都由它异步写到控制台
+void
+klog_init(void)
+{
+  if((klogd = kthread_create(klogd_thread, 0, "klogd")) == 0)
+    panic("klog_init");
+}
@@ -35,6 +35,11 @@ void lst_push(struct list *lst, void *p){
   lst->next = e;
 }
 
+// 插入到链表尾部, 与lst_pop配合即为FIFO
+void lst_push_back(struct list *lst, void *p){
+  lst_push(lst->prev, p);
+}
+
 void lst_print(struct list *lst){
   for(struct list *p = lst->next; p != lst; p = p->next){
     printf(" %p", p);
@@ -12,6 +12,11 @@ int  lst_empty(struct list *lst);
 void lst_remove(struct list *e);
 void* lst_pop(struct list *lst);
 void lst_push(struct list *lst, void *p);
+void lst_push_back(struct list *lst, void *p);
 void lst_print(struct list *lst);
 
+// 由嵌入的链表节点得到包含它的结构体
+#define lst_entry(ptr, type, member) \
+  ((type *)((char *)(ptr) - (uint64)&((type *)0)->member))
+
 #endif
@@ -5,12 +5,10 @@
 #include "sbi.h"
 #include "paging.h"
 
-// from start.c
-extern char stack0[];
-
 // 内核主函数
 void main()
 {
+    uart_init();        // 中断驱动的串口输出
     clear_screen();
     printf("Hello, Gemini-OS!\n");
 
@@ -23,12 +21,24 @@ void main()
 
     printf("Initializing process table...\n");
     proc_init();        // 初始化进程表
+    vdso_init();        // 共享时间页
+    wait_init();        // 睡眠通道的哈希表
+    uring_init();       // 异步系统调用队列
+    futex_init();       // 用户态等待队列
     user_init();        // 创建第一个用户进程
+    softirq_init();     // 软中断与ksoftirqd
+    virtio_blk_init();  // 磁盘, 完成处理在tasklet中
+    rcu_init();         // RCU回调的软中断
+    workqueue_init();   // 创建worker内核线程
+    klog_init();        // 之后printf由klogd异步输出
+    binit();            // 块缓存和bflushd
 
     printf("Initializing trap handling...\n");
-    // 设置sscratch指向内核栈顶, 为中断处理做准备
-    w_sscratch((uint64)stack0 + 4096);
     trapinithart();     // 初始化中断向量和使能
+    string_init();      // 探测V扩展, 选择向量版本的memset/memcpy
+    plic_inithart();    // 打开已登记的外部中断源
+    timer_init();       // 探测Sstc, 设置时间片
+    perf_init();        // 探测SBI PMU和Sscofpmf
     printf("Trap handling initialized.\n");
 
     printf("Starting scheduler...\n");
@@ -12,5 +12,38 @@
 
 // QEMU中virt主机的UART设备地址
 #define UART0 0x10000000L
+#define UART0_IRQ 10
+
+// virtio-mmio磁盘 (virtio_blk.c)
+#define VIRTIO0 0x10001000L
+#define VIRTIO0_IRQ 1
+
+// 平台级中断控制器(PLIC)
+#define PLIC 0x0c000000L
+#define PLIC_SIZE 0x400000
+#define PLIC_PRIORITY (PLIC + 0x0)
+#define PLIC_PENDING (PLIC + 0x1000)
+#define PLIC_SENABLE(hart) (PLIC + 0x2080 + (hart) * 0x100)
+#define PLIC_SPRIORITY(hart) (PLIC + 0x201000 + (hart) * 0x2000)
+#define PLIC_SCLAIM(hart) (PLIC + 0x201004 + (hart) * 0x2000)
+
+// 虚拟地址上限。Sv39有39位, 但只用到38位,
+// 避免对最高位做符号扩展。
+#define MAXVA (1L << (9 + 9 + 9 + 12 - 1))
+
+// trampoline页映射在用户和内核地址空间的最高处
+#define TRAMPOLINE (MAXVA - PGSIZE)
+
+// 每个进程的trapframe页映射在trampoline下面 (仅用户地址空间)
+#define TRAPFRAME (TRAMPOLINE - PGSIZE)
+
+// 只读的共享时间页 (vdso.h), 映射在trapframe下面, 用户态可读
+#define VDSO (TRAPFRAME - PGSIZE)
+
+// 异步系统调用的提交队列和完成队列 (uring.h), 各一页
+#define URING (VDSO - 2 * PGSIZE)
+
+// 用户内存(代码、栈和growproc扩展的堆)的上限
+#define USERTOP URING
 
 #endif // __MEMLAYOUT_H
@@ -52,9 +52,20 @@ extern pagetable_t kernel_pagetable;
 
 // -------------------- SSTATUS/SIE/SIP 等寄存器 -------------------- 
 #define SSTATUS_SIE (1L << 1) // Supervisor Interrupt Enable
+#define SSTATUS_SPIE (1L << 5) // Supervisor Previous Interrupt Enable
+#define SSTATUS_SPP (1L << 8)  // Previous mode, 1=Supervisor, 0=User
+#define SSTATUS_FS (3L << 13)  // 浮点单元状态
+#define SSTATUS_FS_OFF (0L << 13)     // 关闭, 任何浮点指令都会触发非法指令异常
+#define SSTATUS_FS_INITIAL (1L << 13) // 初始状态
+#define SSTATUS_FS_CLEAN (2L << 13)   // 与保存的状态一致
+#define SSTATUS_FS_DIRTY (3L << 13)   // 被修改过, 切换时需要保存
+#define SSTATUS_VS (3L << 9)          // 向量单元状态, 只在string.c中临时打开
+#define SSTATUS_VS_INITIAL (1L << 9)
 #define SIE_SEIE (1L << 9)    // Supervisor External Interrupt Enable
 #define SIE_STIE (1L << 5)    // Supervisor Timer Interrupt Enable
 #define SIE_SSIE (1L << 1)    // Supervisor Software Interrupt Enable
+#define SIE_LCOFIE (1L << 13) // Local Counter Overflow Interrupt Enable (Sscofpmf)
+#define SIP_LCOFIP (1L << 13) // 计数器溢出中断挂起位
 
 
 // -------------------- CSR 读写函数 -------------------- 
@@ -103,16 +114,99 @@ static inline void w_satp(uint64 x) {
   asm volatile("csrw satp, %0" : : "r" (x));
 }
 
+static inline uint64 r_satp() {
+  uint64 x;
+  asm volatile("csrr %0, satp" : "=r" (x));
+  return x;
+}
+
+static inline uint64 r_stval() {
+  uint64 x;
+  asm volatile("csrr %0, stval" : "=r" (x));
+  return x;
+}
+
+// tp寄存器保存当前hart的编号
+static inline uint64 r_tp() {
+  uint64 x;
+  asm volatile("mv %0, tp" : "=r" (x));
+  return x;
+}
+
+static inline void c_sip(uint64 x) {
+  asm volatile("csrc sip, %0" : : "r" (x));
+}
+
+// Sscofpmf的scountovf寄存器 (CSR 0xDA0), 第i位是计数器i的溢出标志
+static inline uint64 r_scountovf() {
+  uint64 x;
+  asm volatile("csrr %0, 0xda0" : "=r" (x));
+  return x;
+}
+
+// s0/fp, 用于沿帧指针回溯调用栈
+static inline uint64 r_fp() {
+  uint64 x;
+  asm volatile("mv %0, s0" : "=r" (x));
+  return x;
+}
+
+static inline uint64 r_scounteren() {
+  uint64 x;
+  asm volatile("csrr %0, scounteren" : "=r" (x));
+  return x;
+}
+
+static inline void w_scounteren(uint64 x) {
+  asm volatile("csrw scounteren, %0" : : "r" (x));
+}
+
 static inline void w_sscratch(uint64 x) {
   asm volatile("csrw sscratch, %0" : : "r" (x));
 }
 
+static inline void w_sepc(uint64 x) {
+  asm volatile("csrw sepc, %0" : : "r" (x));
+}
+
 static inline uint64 r_time() {
   uint64 x;
   asm volatile("csrr %0, time" : "=r" (x));
   return x;
 }
 
+// Sstc扩展的stimecmp寄存器 (CSR 0x14D)。
+// 用编号而不是名字, 旧版汇编器不认识stimecmp。
+static inline uint64 r_stimecmp() {
+  uint64 x;
+  asm volatile("csrr %0, 0x14d" : "=r" (x));
+  return x;
+}
+
+static inline void w_stimecmp(uint64 x) {
+  asm volatile("csrw 0x14d, %0" : : "r" (x));
+}
+
+// 开中断
+static inline void intr_on() {
+  w_sstatus(r_sstatus() | SSTATUS_SIE);
+}
+
+// 关中断
+static inline void intr_off() {
+  w_sstatus(r_sstatus() & ~SSTATUS_SIE);
+}
+
+// 中断当前是否开启
+static inline int intr_get() {
+  return (r_sstatus() & SSTATUS_SIE) != 0;
+}
+
+// 等待中断。即使SIE关闭, 挂起且在sie中使能的中断也会唤醒wfi。
+static inline void wfi() {
+  asm volatile("wfi");
+}
+
 // 刷新TLB的宏
 static inline void sfence_vma() {
   // a zero rs1 means flush all entries.
@@ -123,6 +217,10 @@ static inline void sfence_vma() {
 void dump_pagetable(pagetable_t pt, int level);
 // 递归释放页表层级（不释放叶子映射的物理页本身）
 void destroy_pagetable(pagetable_t pt);
+// 取消用户页表中[va, va+npages*PGSIZE)的映射, do_free为1时同时释放物理页
+void uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free);
+// 释放进程页表及其用户内存
+void proc_freepagetable(pagetable_t pagetable, uint64 sz);
 
 
 #endif // __PAGING_H
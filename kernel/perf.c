@@ -0,0 +1,292 @@
+// 硬件性能计数器 (perf.c)
+//
+// 通过SBI PMU扩展把事件(周期、指令数、缓存缺失等)分配到硬件计数器上,
+// 最多同时打开PERF_SLOTS个。计数器在全系统范围内一直计数, 每次进程切换时
+// 读一次计数器, 把差值记到被换出的进程上, 这样每个进程看到的是自己
+// 运行期间的计数, 切换时不需要SBI调用。
+//
+// 打开事件时给出采样周期并且支持Sscofpmf时, 计数器从-period开始计数,
+// 溢出时产生本地计数器溢出中断(scause 13), 在中断中记录一个样本
+// (写入prof.c的缓冲区, 一样用prof_dump输出), 然后重新装入-period。
+//
+// S模式直接用csrr读hpmcounter, 依赖固件打开mcounteren(OpenSBI默认打开)。
+// SBI的逻辑计数器编号不一定等于CSR编号, 读数时用counter_info给出的CSR。
+//
+// 每个进程记录自己打开的槽, 只能关闭自己打开的, 释放进程时关闭剩下的。
+
+#include "types.h"
+#include "paging.h"
+#include "proc.h"
+#include "sbi.h"
+#include "perf.h"
+#include "syscall.h"
+#include "global_func.h"
+
+struct perf_slot {
+  int refs;               // 打开的次数, 0表示空闲
+  uint64 event;           // SBI的事件编号
+  uint64 period;          // 采样周期, 0表示只计数
+  int ctr;                // 分配到的SBI逻辑计数器
+  int csr;                // 它对应的hpmcounter, CSR编号减0xC00
+  uint64 mask;            // 计数器宽度的掩码
+  uint64 total;           // 全系统的累计计数
+  uint32 gen;             // 每次重新打开加一, 进程中旧的计数作废
+};
+
+static int has_pmu;
+static int has_sscofpmf;
+static int ncounters;
+static int nopen;          // 打开的事件数, 为0时切换路径直接返回
+static struct perf_slot slots[PERF_SLOTS];
+
+// 读CSR编号为0xC00+csr的计数器, 只能用立即数, 所以展开成switch
+#define CTR_CASE(n) case n: asm volatile("csrr %0, %1" : "=r" (x) : "i" (0xc00 + n)); break
+static uint64
+read_counter(int csr)
+{
+  uint64 x = 0;
+
+  switch(csr){
+  CTR_CASE(0);  CTR_CASE(1);  CTR_CASE(2);  CTR_CASE(3);
+  CTR_CASE(4);  CTR_CASE(5);  CTR_CASE(6);  CTR_CASE(7);
+  CTR_CASE(8);  CTR_CASE(9);  CTR_CASE(10); CTR_CASE(11);
+  CTR_CASE(12); CTR_CASE(13); CTR_CASE(14); CTR_CASE(15);
+  CTR_CASE(16); CTR_CASE(17); CTR_CASE(18); CTR_CASE(19);
+  CTR_CASE(20); CTR_CASE(21); CTR_CASE(22); CTR_CASE(23);
+  CTR_CASE(24); CTR_CASE(25); CTR_CASE(26); CTR_CASE(27);
+  CTR_CASE(28); CTR_CASE(29); CTR_CASE(30); CTR_CASE(31);
+  }
+  return x;
+}
+
+// 把上次读数之后的增量记到进程p上(p为0时只计入全局), 然后重新取基准。
+// 在进程切换处关中断调用。
+void
+perf_switch(struct proc *p)
+{
+  struct cpu *c = mycpu();
+
+  if(nopen == 0)
+    return;
+  for(int s = 0; s < PERF_SLOTS; s++){
+    struct perf_slot *sl = &slots[s];
+    uint64 now, d;
+
+    if(sl->refs == 0)
+      continue;
+    now = read_counter(sl->csr);
+    d = (now - c->perf_base[s]) & sl->mask;
+    c->perf_base[s] = now;
+    sl->total += d;
+    if(p == 0)
+      continue;
+    if(p->perf_gen[s] != sl->gen){
+      p->perf_gen[s] = sl->gen;
+      p->perf_count[s] = 0;
+    }
+    p->perf_count[s] += d;
+  }
+}
+
+static void
+perf_start_counter(struct perf_slot *sl)
+{
+  uint64 flags = 0, init = 0;
+
+  if(sl->period){
+    flags = SBI_PMU_START_SET_INIT_VALUE;
+    init = -sl->period & sl->mask;
+  }
+  sbi_ecall(SBI_EID_PMU, SBI_PMU_COUNTER_START, sl->ctr, 1, flags, init, 0);
+}
+
+// 打开事件event, period不为0时每period个事件采样一次。
+// 返回槽号, 失败返回-1。只计数的同一事件共用一个槽。
+int
+perf_open(uint64 event, uint64 period)
+{
+  struct proc *p = myproc();
+  struct perf_slot *sl = 0;
+  struct sbiret r;
+  int s;
+
+  if(!has_pmu || (period && !has_sscofpmf))
+    return -1;
+  if(period && period < PERF_MIN_PERIOD)
+    return -1;
+
+  push_off();
+  for(s = 0; s < PERF_SLOTS; s++){
+    if(slots[s].refs && slots[s].event == event && slots[s].period == 0 && period == 0){
+      if(p->perf_refs[s] == 0xff)
+        goto fail;
+      slots[s].refs++;
+      p->perf_refs[s]++;
+      pop_off();
+      return s;
+    }
+  }
+  for(s = 0; s < PERF_SLOTS; s++){
+    if(slots[s].refs == 0){
+      sl = &slots[s];
+      break;
+    }
+  }
+  if(sl == 0)
+    goto fail;
+
+  r = sbi_ecall(SBI_EID_PMU, SBI_PMU_CONFIG_MATCHING, 0, (1UL << ncounters) - 1,
+                SBI_PMU_CFG_CLEAR_VALUE | SBI_PMU_CFG_SET_MINH, event, 0);
+  if(r.error)
+    goto fail;
+  sl->ctr = r.value;
+  r = sbi_ecall(SBI_EID_PMU, SBI_PMU_COUNTER_INFO, sl->ctr, 0, 0, 0, 0);
+  if(r.error || SBI_PMU_INFO_FW(r.value) ||
+     SBI_PMU_INFO_CSR(r.value) < 0xc00 || SBI_PMU_INFO_CSR(r.value) >= 0xc20){
+    // 固件计数器不能用csrr读, 不支持
+    sbi_ecall(SBI_EID_PMU, SBI_PMU_COUNTER_STOP, sl->ctr, 1, SBI_PMU_STOP_RESET, 0, 0);
+    goto fail;
+  }
+  sl->csr = SBI_PMU_INFO_CSR(r.value) - 0xc00;
+  sl->mask = SBI_PMU_INFO_WIDTH(r.value) >= 64 ? ~0UL : (1UL << SBI_PMU_INFO_WIDTH(r.value)) - 1;
+  sl->event = event;
+  sl->period = period;
+  sl->total = 0;
+  sl->gen++;
+  sl->refs = 1;
+  p->perf_refs[s] = 1;
+  // 先结算其他槽, 新槽从现在开始计数
+  perf_switch(p);
+  perf_start_counter(sl);
+  mycpu()->perf_base[s] = read_counter(sl->csr);
+  nopen++;
+  pop_off();
+  return s;
+
+fail:
+  pop_off();
+  return -1;
+}
+
+// 去掉槽s的一个引用, 最后一个引用去掉时释放计数器。调用者已关中断。
+static void
+slot_put(int s)
+{
+  if(--slots[s].refs == 0){
+    perf_switch(mycpu()->proc);
+    sbi_ecall(SBI_EID_PMU, SBI_PMU_COUNTER_STOP, slots[s].ctr, 1, SBI_PMU_STOP_RESET, 0, 0);
+    nopen--;
+  }
+}
+
+// 关闭当前进程打开的槽s
+int
+perf_close(int s)
+{
+  struct proc *p = myproc();
+
+  if(s < 0 || s >= PERF_SLOTS || p->perf_refs[s] == 0)
+    return -1;
+  push_off();
+  p->perf_refs[s]--;
+  slot_put(s);
+  pop_off();
+  return 0;
+}
+
+// 释放进程时关闭它没有关闭的槽
+void
+perf_release(struct proc *p)
+{
+  push_off();
+  for(int s = 0; s < PERF_SLOTS; s++){
+    for(; p->perf_refs[s] > 0; p->perf_refs[s]--)
+      slot_put(s);
+  }
+  pop_off();
+}
+
+// 当前进程在槽s上的计数
+int64
+perf_read(int s)
+{
+  struct proc *p = myproc();
+  int64 n;
+
+  if(s < 0 || s >= PERF_SLOTS || slots[s].refs == 0)
+    return -1;
+  push_off();
+  perf_switch(p);
+  n = p->perf_count[s];
+  pop_off();
+  return n;
+}
+
+// 本地计数器溢出中断(Sscofpmf)的上半部: 对每个溢出的采样计数器记录一个样本,
+// 再从-period重新开始。pc、user、fp的含义与prof_tick相同。
+void
+perf_overflow_intr(uint64 pc, int user, uint64 fp)
+{
+  struct cpu *c = mycpu();
+  uint64 ovf = r_scountovf();
+
+  c_sip(SIP_LCOFIP);
+  for(int s = 0; s < PERF_SLOTS; s++){
+    struct perf_slot *sl = &slots[s];
+
+    if(sl->refs == 0 || sl->period == 0 || (ovf & (1UL << sl->csr)) == 0)
+      continue;
+    // 重新装入初值前结算, 之后重新取基准
+    perf_switch(c->proc);
+    prof_sample(pc, user, fp);
+    sbi_ecall(SBI_EID_PMU, SBI_PMU_COUNTER_STOP, sl->ctr, 1, 0, 0, 0);
+    perf_start_counter(sl);
+    c->perf_base[s] = read_counter(sl->csr);
+  }
+}
+
+// 打印打开的事件的全系统计数, 调试用
+void
+perf_stat_print(void)
+{
+  uint64 cycles = 0, insns = 0;
+
+  if(!has_pmu)
+    return;
+  push_off();
+  perf_switch(myproc());
+  pop_off();
+  for(int s = 0; s < PERF_SLOTS; s++){
+    if(slots[s].refs == 0)
+      continue;
+    printf("perf: slot %d event %lx ctr %d csr %x period %lu: %lu\n", s, slots[s].event,
+           slots[s].ctr, 0xc00 + slots[s].csr, slots[s].period, slots[s].total);
+    if(slots[s].event == PERF_EV_CYCLES)
+      cycles = slots[s].total;
+    else if(slots[s].event == PERF_EV_INSTRUCTIONS)
+      insns = slots[s].total;
+  }
+  if(cycles && insns)
+    printf("perf: IPC %lu.%02lu\n", insns / cycles, insns * 100 / cycles % 100);
+}
+
+// 探测SBI PMU扩展和Sscofpmf, 需要在trapinithart之后调用
+void
+perf_init(void)
+{
+  if(!sbi_probe_extension(SBI_EID_PMU)){
+    printf("perf: no SBI PMU\n");
+    return;
+  }
+  has_pmu = 1;
+  ncounters = sbi_ecall(SBI_EID_PMU, SBI_PMU_NUM_COUNTERS, 0, 0, 0, 0, 0).value;
+  if(ncounters > 32)
+    ncounters = 32;
+
+  csr_probe_start();
+  r_scountovf();
+  has_sscofpmf = csr_probe_end();
+  if(has_sscofpmf)
+    w_sie(r_sie() | SIE_LCOFIE);
+  printf("perf: %d counters%s\n", ncounters, has_sscofpmf ? ", sscofpmf" : "");
+}
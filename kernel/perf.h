@@ -0,0 +1,11 @@
+#ifndef __PERF_H
+#define __PERF_H
+
+#include "types.h"
+
+// 硬件性能计数器 (perf.c)
+
+#define PERF_SLOTS 4 // 同时打开的事件数
+#define PERF_MIN_PERIOD 10000 // 最小采样周期, 防止溢出中断占满CPU
+
+#endif // __PERF_H
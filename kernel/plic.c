@@ -0,0 +1,104 @@
+// 平台级中断控制器 (plic.c)
+//
+// 外部设备的中断经PLIC汇总后以S模式外部中断通知CPU。
+// 驱动用plic_register登记中断号、优先级和上半部处理函数,
+// 陷入处理中plic_dispatch逐个claim待处理的中断, 调用处理函数后complete。
+// 每个核有自己的使能位、优先级阈值和claim/complete寄存器。
+
+#include "types.h"
+#include "memlayout.h"
+#include "proc.h"
+#include "global_func.h"
+
+#define PLIC_NIRQ 64 // QEMU virt上的中断源不超过这个数
+
+static void (*irq_handlers[PLIC_NIRQ])(void);
+static uint64 irq_count[PLIC_NIRQ];
+
+static inline int
+cpuid(void)
+{
+  return mycpu() - cpus;
+}
+
+// 设置中断源irq的优先级, 0表示屏蔽
+void
+plic_set_priority(int irq, int priority)
+{
+  *(volatile uint32 *)(PLIC_PRIORITY + irq * 4) = priority;
+}
+
+// 在本核上打开或关闭中断源irq
+static void
+plic_enable(int irq, int on)
+{
+  volatile uint32 *en = (volatile uint32 *)PLIC_SENABLE(cpuid()) + irq / 32;
+
+  if(on)
+    *en |= 1U << (irq % 32);
+  else
+    *en &= ~(1U << (irq % 32));
+}
+
+// 登记中断源irq的处理函数并以priority打开它。
+// 处理函数在关中断的上半部中执行, 耗时的工作应交给软中断。
+void
+plic_register(int irq, int priority, void (*handler)(void))
+{
+  if(irq <= 0 || irq >= PLIC_NIRQ || priority <= 0)
+    panic("plic_register");
+  irq_handlers[irq] = handler;
+  plic_set_priority(irq, priority);
+  plic_enable(irq, 1);
+}
+
+// 本核的初始化: 优先级阈值设为0, 接受所有优先级大于0的中断,
+// 并打开所有已登记的中断源
+void
+plic_inithart(void)
+{
+  *(volatile uint32 *)PLIC_SPRIORITY(cpuid()) = 0;
+  for(int irq = 1; irq < PLIC_NIRQ; irq++)
+    if(irq_handlers[irq])
+      plic_enable(irq, 1);
+}
+
+// 取得一个待处理的中断号, 没有则返回0
+int
+plic_claim(void)
+{
+  return *(volatile uint32 *)PLIC_SCLAIM(cpuid());
+}
+
+// 告诉PLIC中断irq已处理完, 之后它才能再次产生
+void
+plic_complete(int irq)
+{
+  *(volatile uint32 *)PLIC_SCLAIM(cpuid()) = irq;
+}
+
+// S模式外部中断的上半部: 处理所有待处理的中断
+void
+plic_dispatch(void)
+{
+  int irq;
+
+  while((irq = plic_claim()) != 0){
+    if(irq < PLIC_NIRQ && irq_handlers[irq]){
+      irq_count[irq]++;
+      irq_handlers[irq]();
+    } else {
+      printf("plic: unexpected irq %d\n", irq);
+    }
+    plic_complete(irq);
+  }
+}
+
+// 打印各中断源的中断次数, 调试用
+void
+plic_stat_print(void)
+{
+  for(int irq = 1; irq < PLIC_NIRQ; irq++)
+    if(irq_count[irq])
+      printf("irq %d: %lu\n", irq, irq_count[irq]);
+}
@@ -1,16 +1,62 @@
+// 格式化输出 (printf.c)
+//
+// printf先用vsnprintf格式化到栈上的缓冲区, 再作为一条记录追加到
+// klog.c的日志环中, 由klogd线程异步写到控制台。
+// 调用者只付出格式化和一次内存拷贝的代价, 不等待串口。
+
 #include <stdarg.h>
 
 #include "types.h"
+#include "global_func.h"
 
+#define PRINTF_BUF 256 // 单次printf的最大长度, 超出部分截断
 
-void console_putc(char c);
 static char digits[] = "0123456789abcdef";
 
+// 向有界缓冲区输出, 超出部分只计数不写入
+struct outbuf {
+  char *buf;
+  int size;
+  int n;
+};
+
 static void
-printint(long long xx, int base, int sign)
+outc(struct outbuf *o, char c)
 {
-  char buf[20];
-  int i;
+  if(o->n < o->size - 1)
+    o->buf[o->n] = c;
+  o->n++;
+}
+
+// 输出len个字符的s, 按width和flags补齐
+static void
+outpad(struct outbuf *o, const char *s, int len, int width, int left, char pad)
+{
+  if(!left){
+    // 补0时符号要在0之前
+    if(pad == '0' && len > 0 && s[0] == '-'){
+      outc(o, '-');
+      s++;
+      len--;
+      width--;
+    }
+    for(; width > len; width--)
+      outc(o, pad);
+  }
+  for(int i = 0; i < len; i++)
+    outc(o, s[i]);
+  if(left)
+    for(; width > len; width--)
+      outc(o, ' ');
+}
+
+static void
+printint(struct outbuf *o, long long xx, int base, int sign,
+         int width, int left, char pad)
+{
+  char buf[24];
+  char out[24];
+  int i, n = 0;
   unsigned long long x;
 
   if(sign && (sign = (xx < 0)))
@@ -27,95 +73,125 @@ printint(long long xx, int base, int sign)
     buf[i++] = '-';
 
   while(--i >= 0)
-    console_putc(buf[i]);
+    out[n++] = buf[i];
+  outpad(o, out, n, width, left, pad);
 }
 
 static void
-printptr(uint64 x)
+printptr(struct outbuf *o, uint64 x)
 {
   int i;
-  console_putc('0');
-  console_putc('x');
+  outc(o, '0');
+  outc(o, 'x');
   for (i = 0; i < (sizeof(uint64) * 2); i++, x <<= 4)
-    console_putc(digits[x >> (sizeof(uint64) * 8 - 4)]);
+    outc(o, digits[x >> (sizeof(uint64) * 8 - 4)]);
 }
 
-// Print to the console.
+// 格式化到buf, 最多写size-1个字符并以0结尾。
+// 返回完整输出需要的长度(不含结尾的0), 大于等于size表示被截断。
+// 支持 %d %u %x (可加l/ll) %p %c %s %%, 以及'-'左对齐、'0'补零和宽度。
 int
-printf(char *fmt, ...)
+vsnprintf(char *buf, int size, const char *fmt, va_list ap)
 {
-  va_list ap;
-  int i, char_now, c0, c1, c2;
+  struct outbuf o = { buf, size, 0 };
+  int i, c, width, left;
+  int lng;
+  char pad;
   char *s;
-  va_start(ap, fmt);
-  for(i = 0; (char_now = fmt[i] & 0xff) != 0; i++){
-    if(char_now != '%'){
-      console_putc(char_now);
+
+  for(i = 0; (c = fmt[i] & 0xff) != 0; i++){
+    if(c != '%'){
+      outc(&o, c);
       continue;
     }
-    i++;
-    c0 = fmt[i+0] & 0xff;
-    c1 = c2 = 0;
-    if(c0) c1 = fmt[i+1] & 0xff;
-    if(c1) c2 = fmt[i+2] & 0xff;
-    if(c0 == 'd'){
-      printint(va_arg(ap, int), 10, 1);
-    } else if(c0 == 'l' && c1 == 'd'){
-      printint(va_arg(ap, uint64), 10, 1);
-      i += 1;
-    } else if(c0 == 'l' && c1 == 'l' && c2 == 'd'){
-      printint(va_arg(ap, uint64), 10, 1);
-      i += 2;
-    } else if(c0 == 'u'){
-      printint(va_arg(ap, uint32), 10, 0);
-    } else if(c0 == 'l' && c1 == 'u'){
-      printint(va_arg(ap, uint64), 10, 0);
-      i += 1;
-    } else if(c0 == 'l' && c1 == 'l' && c2 == 'u'){
-      printint(va_arg(ap, uint64), 10, 0);
-      i += 2;
-    } else if(c0 == 'x'){
-      printint(va_arg(ap, uint32), 16, 0);
-    } else if(c0 == 'l' && c1 == 'x'){
-      printint(va_arg(ap, uint64), 16, 0);
-      i += 1;
-    } else if(c0 == 'l' && c1 == 'l' && c2 == 'x'){
-      printint(va_arg(ap, uint64), 16, 0);
-      i += 2;
-    } else if(c0 == 'p'){
-      printptr(va_arg(ap, uint64));
-    } else if(c0 == 'c'){
-      console_putc(va_arg(ap, uint));
-    } else if(c0 == 's'){
+    c = fmt[++i] & 0xff;
+
+    // 标志和宽度
+    left = 0;
+    pad = ' ';
+    for(;; c = fmt[++i] & 0xff){
+      if(c == '-')
+        left = 1;
+      else if(c == '0')
+        pad = '0';
+      else
+        break;
+    }
+    if(left)
+      pad = ' ';
+    width = 0;
+    for(; c >= '0' && c <= '9'; c = fmt[++i] & 0xff)
+      width = width * 10 + (c - '0');
+
+    // 长度: l和ll都按64位处理
+    lng = 0;
+    for(; c == 'l'; c = fmt[++i] & 0xff)
+      lng = 1;
+
+    if(c == 'd'){
+      printint(&o, lng ? va_arg(ap, uint64) : va_arg(ap, int), 10, 1, width, left, pad);
+    } else if(c == 'u'){
+      printint(&o, lng ? va_arg(ap, uint64) : va_arg(ap, uint32), 10, 0, width, left, pad);
+    } else if(c == 'x'){
+      printint(&o, lng ? va_arg(ap, uint64) : va_arg(ap, uint32), 16, 0, width, left, pad);
+    } else if(c == 'p'){
+      printptr(&o, va_arg(ap, uint64));
+    } else if(c == 'c'){
+      char ch = va_arg(ap, uint);
+      outpad(&o, &ch, 1, width, left, ' ');
+    } else if(c == 's'){
       if((s = va_arg(ap, char*)) == 0)
         s = "(null)";
-      for(; *s; s++)
-        console_putc(*s);
-    } else if(c0 == '%'){
-      console_putc('%');
-    } else if(c0 == 0){
+      outpad(&o, s, strlen(s), width, left, ' ');
+    } else if(c == '%'){
+      outc(&o, '%');
+    } else if(c == 0){
       break;
     } else {
       // Print unknown % sequence to draw attention.
-      console_putc('%');
-      console_putc(c0);
+      outc(&o, '%');
+      outc(&o, c);
     }
-
   }
-  va_end(ap);
-  return 0;
+  if(size > 0)
+    buf[o.n < size ? o.n : size - 1] = 0;
+  return o.n;
 }
 
+int
+snprintf(char *buf, int size, const char *fmt, ...)
+{
+  va_list ap;
+  int n;
 
+  va_start(ap, fmt);
+  n = vsnprintf(buf, size, fmt, ap);
+  va_end(ap);
+  return n;
+}
 
-void
-clear_screen(void)
+// Print to the console.
+// 格式化后追加到日志环, 返回输出的字符数
+int
+printf(char *fmt, ...)
 {
-  printf("\033[2J\033[H");
+  va_list ap;
+  char buf[PRINTF_BUF];
+  int n;
+
+  va_start(ap, fmt);
+  n = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  if(n > sizeof(buf) - 1)
+    n = sizeof(buf) - 1;
+  klog_write(buf, n);
+  return n;
 }
 
+
+
 void
-printfinit(void)
+clear_screen(void)
 {
-  //initlock(&pr.lock, "pr");
+  printf("\033[2J\033[H");
 }
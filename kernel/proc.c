@@ -3,112 +3,613 @@
 #include "proc.h"
 #include "global_func.h"
 #include "memlayout.h"
+#include "paging.h"
+#include "rcu.h"
 
-#define NPROC 64 // 最大进程数
+// 进程结构体按需用kmalloc分配, 没有数量上限。
+// 退出的进程连同它的内核栈和trapframe一起放进proc_cache,
+// 下次分配直接取出, 不需要再走伙伴系统的分裂/合并, O(1)。
+// 缓存有上限, 内存不足时由kalloc.c的shrinker回收。
+// 按PID查找通过pid_table哈希表, 桶数随进程数量倍增, 查找O(1)且不加锁。
+// 释放的进程对象要等RCU宽限期之后才放回缓存, 见free_proc。
+#define PID_HASH_INIT 64   // 初始桶数, 必须是2的幂
+#define PROC_CACHE_MAX 64  // 缓存的进程对象上限
 
-struct proc proc[NPROC];
 struct proc *initproc;
 
 struct cpu cpus[1];
 
 int nextpid = 1;
 
+static struct list proc_cache;  // 可复用的proc, 仍持有kstack和trapframe (通过rq_link链接)
+static int proc_cached;         // proc_cache中的数量
+static int proc_cache_max = PROC_CACHE_MAX;
+// PID哈希表 (通过hash_link链接)
+struct pid_table {
+  struct rcu_head rcu;
+  int nbuckets;                 // 桶数, 2的幂
+  struct list buckets[];
+};
+static struct pid_table *pid_table;
+static struct spinlock pid_lock; // 串行化pid_table的修改和PID分配
+static uint64 pid_seq;          // 扩容期间为奇数
+static int nproc;               // 当前存在的进程数
+static struct list runq;        // 可运行进程队列, FIFO (通过rq_link链接)
+
 void forkret(void);
+static void kthread_start(void);
+static void proc_timeout(void *arg);
+static void free_proc_rcu(struct rcu_head *head);
 extern void swtch(struct context*, struct context*);
 
 extern char _initcode_start[], _initcode_end[];
 
+// 当前CPU。目前只支持单核
+struct cpu*
+mycpu(void)
+{
+  return &cpus[0];
+}
+
+// 当前CPU上运行的进程, 没有则返回0
+struct proc*
+myproc(void)
+{
+  return mycpu()->proc;
+}
+
 // 初始化进程表
 void
 proc_init(void)
 {
-  struct proc *p;
-  for(p = proc; p < &proc[NPROC]; p++) {
-      p->state = UNUSED;
+  lst_init(&proc_cache);
+  lst_init(&runq);
+  initlock(&pid_lock, "pid");
+  pid_table = kmalloc(sizeof(struct pid_table) + sizeof(struct list) * PID_HASH_INIT);
+  if(pid_table == 0)
+    panic("proc_init");
+  pid_table->nbuckets = PID_HASH_INIT;
+  for(int i = 0; i < PID_HASH_INIT; i++)
+    lst_init(&pid_table->buckets[i]);
+  kalloc_register_shrinker(proc_cache_shrink);
+}
+
+// ===== PID哈希表 =====
+//
+// 查找不加锁: 读者在RCU读侧临界区中遍历桶, 进程对象在宽限期之后
+// 才会被重用或释放。插入、删除和扩容由pid_lock串行化。
+// 扩容会把节点搬到新表的桶里, 正在旧桶上的读者可能被带到新桶中,
+// 所以扩容期间pid_seq为奇数, 读者发现pid_seq变化就从头重新查找。
+
+static inline struct list*
+pid_bucket(struct pid_table *t, int pid)
+{
+  return &t->buckets[(uint)pid & (t->nbuckets - 1)];
+}
+
+static void
+pid_table_free_rcu(struct rcu_head *head)
+{
+  kfree(lst_entry(head, struct pid_table, rcu));
+}
+
+// 进程数超过桶数的两倍时把哈希表扩大一倍。调用者持有pid_lock。
+// 扩容是O(n)的, 但均摊到每次分配是O(1); 内存不足时保持原样, 只是链变长。
+static void
+pid_table_grow(void)
+{
+  struct pid_table *old = pid_table;
+  struct pid_table *new;
+  int n = old->nbuckets * 2;
+
+  new = kmalloc(sizeof(struct pid_table) + sizeof(struct list) * n);
+  if(new == 0)
+    return;
+  new->nbuckets = n;
+  for(int i = 0; i < n; i++)
+    lst_init(&new->buckets[i]);
+
+  __atomic_store_n(&pid_seq, pid_seq + 1, __ATOMIC_RELEASE);
+  for(int i = 0; i < old->nbuckets; i++){
+    while(!lst_empty(&old->buckets[i])){
+      struct proc *p = lst_entry(lst_pop(&old->buckets[i]), struct proc, hash_link);
+      lst_push_rcu(pid_bucket(new, p->pid), &p->hash_link);
+    }
   }
+  rcu_assign_pointer(pid_table, new);
+  __atomic_store_n(&pid_seq, pid_seq + 1, __ATOMIC_RELEASE);
+  // 可能还有读者在旧表上
+  call_rcu(&old->rcu, pid_table_free_rcu);
 }
 
-// 分配一个新进程
-// 找到一个UNUSED的proc, 初始化它的状态为USED, 分配PID
-// 并为其分配一个内核栈和trapframe
-struct proc* alloc_proc(void)
+// 按PID查找进程, 不存在返回0。
+// 调用者需在RCU读侧临界区中(rcu_read_lock或已关中断),
+// 返回的进程在临界区结束之前一直有效。
+struct proc*
+find_proc(int pid)
 {
+  struct pid_table *t;
+  struct list *b, *e;
   struct proc *p;
+  uint64 seq;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    if(p->state == UNUSED) {
-      goto found;
-    }
+retry:
+  while((seq = __atomic_load_n(&pid_seq, __ATOMIC_ACQUIRE)) & 1)
+    ;
+  t = rcu_dereference(pid_table);
+  b = pid_bucket(t, pid);
+  for(e = rcu_dereference(b->next); e != b; e = rcu_dereference(e->next)){
+    if(__atomic_load_n(&pid_seq, __ATOMIC_ACQUIRE) != seq)
+      goto retry;
+    p = lst_entry(e, struct proc, hash_link);
+    if(p->pid == pid)
+      return p;
   }
-  return 0; // 没找到
+  if(__atomic_load_n(&pid_seq, __ATOMIC_ACQUIRE) != seq)
+    goto retry;
+  return 0;
+}
 
-found:
-  p->pid = nextpid++;
-  p->state = USED;
+// ===== 分配与释放 =====
+
+// 复位内核栈顶的上下文: 让ra指向forkret, sp指向内核栈顶
+static void
+proc_init_context(struct proc *p)
+{
+  memset(&p->context, 0, sizeof(p->context));
+  p->context.ra = (uint64)forkret;
+  p->context.sp = p->kstack + PGSIZE;
+}
+
+// 分配一个新的proc及其trapframe和内核栈
+static struct proc*
+proc_create(void)
+{
+  struct proc *p;
+
+  if((p = kmalloc(sizeof(struct proc))) == 0)
+    return 0;
+  memset(p, 0, sizeof(*p));
 
   // 为进程分配trapframe页
   if((p->trapframe = (struct trapframe *)alloc_page()) == 0){
-    p->state = UNUSED;
+    kfree(p);
     return 0;
   }
+  memset(p->trapframe, 0, sizeof(struct trapframe));
 
   // 为进程分配内核栈
   if((p->kstack = (uint64)alloc_page()) == 0) {
     // free trapframe page
     free_page(p->trapframe);
-    p->state = UNUSED;
+    kfree(p);
     return 0;
   }
 
-  // 初始化上下文, 让ra指向forkret, sp指向内核栈顶
-  memset(&p->context, 0, sizeof(p->context));
-  p->context.ra = (uint64)forkret;
-  p->context.sp = p->kstack + PGSIZE;
+  proc_init_context(p);
+  timer_setup(&p->timer, proc_timeout, p);
+  lst_init(&p->ipc_sendq);
+  return p;
+}
+
+// 释放proc及其trapframe和内核栈
+static void
+proc_destroy(struct proc *p)
+{
+  free_page(p->trapframe);
+  free_page((void*)p->kstack);
+  kfree(p);
+}
+
+// 释放最多n个缓存的进程对象, 返回释放的页数。
+// kalloc.c在内存不足时调用。
+int
+proc_cache_shrink(int n)
+{
+  struct proc *p;
+  int freed = 0;
+
+  for(; n > 0; n--){
+    push_off();
+    if(lst_empty(&proc_cache)){
+      pop_off();
+      break;
+    }
+    p = lst_entry(lst_pop(&proc_cache), struct proc, rq_link);
+    proc_cached--;
+    pop_off();
+    proc_destroy(p);
+    freed += 2;
+  }
+  return freed;
+}
+
+// 分配一个新进程
+// 优先复用proc_cache中的进程对象, 它的内核栈、trapframe和上下文
+// 在回收时已经准备好; 缓存为空时才新分配。
+// 初始化状态为USED, 分配PID
+struct proc* alloc_proc(void)
+{
+  struct proc *p = 0;
+
+  push_off();
+  if(!lst_empty(&proc_cache)){
+    p = lst_entry(lst_pop(&proc_cache), struct proc, rq_link);
+    proc_cached--;
+  }
+  pop_off();
+  if(p == 0 && (p = proc_create()) == 0)
+    return 0; // 内存不足
+
+  acquire(&pid_lock);
+  p->pid = nextpid++;
+  p->trapframe->pid = p->pid;
+  p->state = USED;
+  memset(p->perf_gen, 0, sizeof(p->perf_gen));
+  memset(p->perf_refs, 0, sizeof(p->perf_refs));
+  lst_push_rcu(pid_bucket(pid_table, p->pid), &p->hash_link);
+  if(++nproc > 2 * pid_table->nbuckets)
+    pid_table_grow();
+  release(&pid_lock);
+  TRACE(TRACE_ALLOC_PROC, p->pid, 0, 0);
 
   return p;
 }
 
+// 释放进程的资源, 从PID哈希表中删除。进程对象本身要等RCU宽限期
+// 之后才由free_proc_rcu处理: 缓存未满时保留内核栈和trapframe并预先复位,
+// 放回proc_cache; 否则全部释放。
+// p不能是当前正在其内核栈上运行的进程。
+void
+free_proc(struct proc *p)
+{
+  timer_cancel(&p->timer);
+  fp_release(p);
+  uring_free(p);
+  perf_release(p);
+  if(p->pagetable)
+    proc_freepagetable(p->pagetable, p->sz);
+  p->pagetable = 0;
+  p->sz = 0;
+  p->name[0] = 0;
+  p->kfn = 0;
+  p->karg = 0;
+  p->timedout = 0;
+  p->xstate = 0;
+  p->ipc_state = IPC_NONE;
+  memset(&p->sched_info, 0, sizeof(p->sched_info));
+
+  acquire(&pid_lock);
+  lst_remove_rcu(&p->hash_link);
+  nproc--;
+  release(&pid_lock);
+  p->pid = 0;
+  p->state = UNUSED;
+  // 可能还有读者刚通过find_proc拿到p
+  call_rcu(&p->rcu, free_proc_rcu);
+}
+
+// 宽限期之后, 已经没有读者引用p, 放回缓存或释放
+static void
+free_proc_rcu(struct rcu_head *head)
+{
+  struct proc *p = lst_entry(head, struct proc, rcu);
+  int cache;
+
+  push_off();
+  cache = proc_cached < proc_cache_max;
+  if(cache)
+    proc_cached++;
+  pop_off();
+
+  if(!cache){
+    proc_destroy(p);
+    return;
+  }
+  // 清除上一个进程留下的用户寄存器, 复位上下文
+  memset(p->trapframe, 0, sizeof(struct trapframe));
+  proc_init_context(p);
+  push_off();
+  lst_push(&proc_cache, &p->rq_link);
+  pop_off();
+}
+
+// 测量进程创建/回收的速度: 关闭和打开缓存各做n次alloc_proc/free_proc。
+// free_proc要等RCU宽限期之后才把对象放回缓存, 所以每BENCH_BATCH次
+// 等一个宽限期(不计时), 让缓存补满, 也不会积压n个RCU回调。
+// 每次都会消耗一个PID, 只在控制台按^B时运行。
+#define BENCH_BATCH 32
+void
+proc_bench(int n)
+{
+  struct proc *p;
+  uint64 t0, ticks;
+  int saved = proc_cache_max;
+
+  for(int pass = 0; pass < 2; pass++){
+    proc_cache_max = pass == 0 ? 0 : saved;
+    synchronize_rcu();
+    proc_cache_shrink(proc_cached);
+    ticks = 0;
+    for(int i = 0; i < n; ){
+      t0 = r_time();
+      for(int j = 0; j < BENCH_BATCH && i < n; j++, i++){
+        if((p = alloc_proc()) == 0)
+          panic("proc_bench");
+        free_proc(p);
+      }
+      ticks += r_time() - t0;
+      synchronize_rcu();
+    }
+    if(ticks == 0)
+      ticks = 1;
+    printf("proc_bench: cache %s: %d spawn/exit in %lu ticks, %lu per second\n",
+           pass == 0 ? "off" : "on", n, ticks, (uint64)n * TIMER_FREQ / ticks);
+  }
+  proc_cache_max = saved;
+}
+
 // forkret: 新进程的入口点
 void forkret()
 {
-  // 我们还不能返回到用户空间，所以暂时什么都不做
-  // 后续这里将调用usertrapret
+  // 调度器在push_off之后切换过来, 在这里配对pop_off
+  pop_off();
+
+  // 第一次返回用户空间
+  usertrapret();
+}
+
+// 标记为可运行并加入运行队列尾部, 调用者需已关中断
+static void
+runq_add(struct proc *p, int wakeup)
+{
+  sched_stat_enqueue(p, wakeup);
+  p->state = RUNNABLE;
+  lst_push_back(&runq, &p->rq_link);
+}
+
+// 创建一个内核线程, 在自己的内核栈上执行fn(arg), fn返回后线程退出。
+// 内核线程没有用户页表, 始终运行在内核页表下, 切换时不需要改satp。
+struct proc*
+kthread_create(void (*fn)(void *), void *arg, char *name)
+{
+  struct proc *p;
+
+  if((p = alloc_proc()) == 0)
+    return 0;
+  p->kfn = fn;
+  p->karg = arg;
+  p->context.ra = (uint64)kthread_start;
+  safestrcpy(p->name, name, sizeof(p->name));
+
+  push_off();
+  runq_add(p, 0);
+  pop_off();
+  return p;
+}
+
+// 内核线程的入口点
+static void
+kthread_start(void)
+{
+  struct proc *p = myproc();
+
+  // 与forkret一样, 配对调度器的push_off
+  pop_off();
+  p->kfn(p->karg);
+  exit(0);
+}
+
+// 切换回调度器。调用者必须已push_off且只有一层, 并已修改了p->state。
+// intena属于这个内核线程而不是CPU, 所以要在切换前后保存恢复。
+void
+sched(void)
+{
+  int intena;
+  struct proc *p = myproc();
+
+  if(mycpu()->noff != 1)
+    panic("sched noff");
+  if(p->state == RUNNING)
+    panic("sched running");
+  if(intr_get())
+    panic("sched interruptible");
+  if(mycpu()->rcu_nesting)
+    panic("sched in rcu read section");
+
+  intena = mycpu()->intena;
+  fp_switch_out(p);
+  sched_stat_out(p);
+  perf_switch(p);
+  rcu_qs();
+  TRACE(TRACE_SWITCH, p->pid, 0, 0);
+  swtch(&p->context, &mycpu()->context);
+  mycpu()->intena = intena;
+}
+
+// 不经过调度器, 直接从当前进程切换到next, next继承剩余的时间片。
+// 调用条件与sched相同; next必须在SLEEPING状态, 不在运行队列上。
+void
+proc_switch_to(struct proc *next)
+{
+  int intena;
+  struct cpu *c = mycpu();
+  struct proc *p = c->proc;
+
+  if(c->noff != 1)
+    panic("proc_switch_to noff");
+  if(p->state == RUNNING)
+    panic("proc_switch_to running");
+  if(next->state != SLEEPING)
+    panic("proc_switch_to next");
+  if(intr_get())
+    panic("proc_switch_to interruptible");
+  if(c->rcu_nesting)
+    panic("proc_switch_to in rcu read section");
+
+  intena = c->intena;
+  fp_switch_out(p);
+  sched_stat_out(p);
+  perf_switch(p);
+  rcu_qs();
+  next->state = RUNNING;
+  c->proc = next;
+  sched_stat_dispatch(next, 1);
+  TRACE(TRACE_SWITCH, p->pid, next->pid, 1);
+  swtch(&p->context, &next->context);
+  c->intena = intena;
+}
+
+// 放弃CPU, 进入下一轮调度
+void
+yield(void)
+{
+  struct proc *p = myproc();
+
+  push_off();
+  p->sched_info.nr_voluntary++;
+  runq_add(p, 0);
+  sched();
+  pop_off();
+}
+
+// 时间片用完, 被抢占
+void
+yield_preempt(void)
+{
+  struct proc *p = myproc();
+
+  push_off();
+  mycpu()->need_resched = 0;
+  p->sched_info.nr_involuntary++;
+  runq_add(p, 0);
+  sched();
+  pop_off();
+}
+
+// 唤醒一个睡眠的进程
+void
+wakeup_proc(struct proc *p)
+{
+  push_off();
+  if(p->state == SLEEPING)
+    runq_add(p, 1);
+  pop_off();
+}
+
+// 当前进程退出。
+// 不能在自己的内核栈上释放它, 所以只标记为ZOMBIE, 由调度器回收。
+void
+exit(int status)
+{
+  struct proc *p = myproc();
+
+  if(p == initproc)
+    panic("init exiting");
+  uring_exit(p);
+  push_off();
+  ipc_exit(p);
+  p->xstate = status;
+  p->state = ZOMBIE;
+  sched();
+  panic("zombie exit");
+}
+
+// 进程超时定时器的回调, 在TIMER_SOFTIRQ中执行
+static void
+proc_timeout(void *arg)
+{
+  struct proc *p = arg;
+
+  p->timedout = 1;
+  wakeup_proc(p);
 }
 
-// 一个非常简单的调度器。循环遍历进程表，
-// 寻找一个可运行的(RUNNABLE)进程，然后切换到它。
+// 睡眠到time CSR到达deadline
+void
+sleep_until(uint64 deadline)
+{
+  struct proc *p = myproc();
+
+  push_off();
+  p->timedout = 0;
+  timer_add(&p->timer, deadline);
+  p->state = SLEEPING;
+  sched();
+  timer_cancel(&p->timer);
+  pop_off();
+}
+
+// 一个非常简单的调度器。从运行队列头部取出一个可运行的进程,
+// 然后切换到它; 被抢占或让出的进程排到队尾, 即轮转调度。
+// 没有可运行的进程时, 编程下一个时钟期限并wfi, 不再空转。
 void
 scheduler(void)
 {
   struct proc *p;
-  struct cpu *c = &cpus[0];
+  struct cpu *c = mycpu();
   
   c->proc = 0; // 当前没有进程在运行
+  // 浮点单元关闭, 进程第一次使用浮点时才装入它的状态 (见fpu.c)
+  w_sstatus(r_sstatus() & ~SSTATUS_FS);
+  rcu_start();
   for(;;){
-    // 在RISC-V中, M模式下的中断是默认开启的。
-    // S模式下的中断需要手动开启。
-    // 我们将在trap.c中处理中断使能。
-
-    // 遍历进程表
-    for(p = proc; p < &proc[NPROC]; p++) {
-      if(p->state == RUNNABLE) {
-        // 找到了一个可运行的进程，准备切换
-        p->state = RUNNING;
-        c->proc = p;
-        printf("scheduler: 进程 %d 开始运行\n", p->pid);
-        // swtch是一个汇编函数, 它会保存当前上下文(调度器的上下文)
-        // 到c->context, 然后恢复p->context指定的下一个进程的上下文
-        // 从而实现进程切换。
-        swtch(&c->context, &p->context);
-
-        // 当进程切换回来时, 说明它已经执行了一段时间。
-        // 进程应该在返回前改变自己的状态(例如, 变为RUNNABLE或SLEEPING)
-        c->proc = 0;
-      }
+    // 短暂开中断, 让挂起的中断得到处理。
+    // 之后关中断检查, 这样从"没有可运行进程"到wfi之间不会丢失唤醒。
+    intr_on();
+    push_off();
+    // 调度器循环中没有任何读者
+    rcu_qs();
+
+    if(lst_empty(&runq)){
+      uint64 t0 = r_time();
+      timer_idle();
+      sched_stat_idle(r_time() - t0);
+      pop_off();
+      continue;
     }
+
+    // 取出队首进程，准备切换
+    p = lst_entry(lst_pop(&runq), struct proc, rq_link);
+    p->state = RUNNING;
+    c->proc = p;
+    sched_stat_dispatch(p, 0);
+    timer_start_slice();
+    perf_switch(0); // 调度器自己的计数不记到进程上
+    TRACE(TRACE_SWITCH, 0, p->pid, 0);
+    // swtch是一个汇编函数, 它会保存当前上下文(调度器的上下文)
+    // 到c->context, 然后恢复p->context指定的下一个进程的上下文
+    // 从而实现进程切换。
+    swtch(&c->context, &p->context);
+
+    // 当进程切换回来时, 说明它已经执行了一段时间。
+    // 进程应该在返回前改变自己的状态(例如, 变为RUNNABLE或SLEEPING)
+    // 中间可能经过了proc_switch_to, 回到调度器的不一定是p
+    p = c->proc;
+    c->proc = 0;
+    // 已退出的进程在调度器的栈上回收
+    if(p->state == ZOMBIE)
+      free_proc(p);
+    pop_off();
   }
 }
 
+// 把进程p的用户内存扩大n字节, 返回新内存的起始地址, 失败返回-1
+int64
+growproc(struct proc *p, uint64 n)
+{
+  uint64 oldsz = p->sz;
+
+  if(n == 0)
+    return oldsz;
+  if(oldsz + n < oldsz || oldsz + n > USERTOP)
+    return -1;
+  if(uvmalloc(p->pagetable, oldsz, oldsz + n) == 0)
+    return -1;
+  p->sz = oldsz + n;
+  return oldsz;
+}
+
 // 创建第一个用户进程
 void
 user_init(void)
@@ -139,7 +640,39 @@ user_init(void)
   // 设置用户栈顶, 用户栈位于虚拟地址空间的顶部
   p->trapframe->sp = PGSIZE;
 
-  p->state = RUNNABLE;
+  push_off();
+  runq_add(p, 0);
+  pop_off();
 
   printf("user_init: 第一个进程已创建, 等待调度!\n");
 }
+
+// 打印进程列表, 调试用 (控制台^P)
+void
+procdump(void)
+{
+  static char *states[] = {
+  [UNUSED]    "unused",
+  [USED]      "used",
+  [SLEEPING]  "sleep",
+  [RUNNABLE]  "runble",
+  [RUNNING]   "run",
+  [ZOMBIE]    "zombie"
+  };
+  struct pid_table *t;
+  struct list *b, *e;
+  struct proc *p;
+
+  printf("\n");
+  rcu_read_lock();
+  t = rcu_dereference(pid_table);
+  for(int i = 0; i < t->nbuckets; i++){
+    b = &t->buckets[i];
+    for(e = rcu_dereference(b->next); e != b; e = rcu_dereference(e->next)){
+      p = lst_entry(e, struct proc, hash_link);
+      printf("%d %s %s run %lu ms\n", p->pid, states[p->state], p->name,
+             p->sched_info.run_time / TICK_CYCLES);
+    }
+  }
+  rcu_read_unlock();
+}
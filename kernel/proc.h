@@ -3,6 +3,12 @@
 
 #include "types.h"
 #include "paging.h"
+#include "timer.h"
+#include "list.h"
+#include "ipc.h"
+#include "schedstat.h"
+#include "rcu.h"
+#include "perf.h"
 
 // 内核上下文切换时保存的寄存器
 struct context {
@@ -27,9 +33,20 @@ struct context {
 // 每个CPU核心的状态
 struct cpu {
   struct proc *proc;          // 当前在CPU上运行的进程, 如果没有则为null
+  struct proc *fp_owner;      // 浮点寄存器中当前保存的是哪个进程的状态
   struct context context;     // 调度器的上下文, swtch切换到这里来进入调度器
   int noff;                   // 关中断的嵌套深度
   int intena;                 // 在关中断之前, 中断是否是开启的
+  uint64 slice_end;           // 当前进程时间片结束的时刻 (time CSR)
+  uint32 softirq_pending;     // 挂起的软中断 (softirq.c)
+  int in_irq;                 // 在中断上半部中
+  int in_softirq;             // 在执行软中断
+  int need_resched;           // 时间片在软中断中用完, 等外层陷入返回时让出
+  int rcu_nesting;            // RCU读侧临界区的嵌套深度
+  uint64 irq_start;           // 当前上半部开始的时刻
+  uint64 irqoff_start;        // 当前push_off关中断区间开始的时刻
+  uint64 perf_base[PERF_SLOTS]; // 各计数器上次结算时的读数 (perf.c)
+  uint64 prof_next;           // 下一次采样的时刻, 0表示没有在采样 (prof.c)
 };
 
 extern struct cpu cpus[1]; // 目前只支持单核
@@ -73,8 +90,17 @@ struct trapframe {
   /* 264 */ uint64 t4;
   /* 272 */ uint64 t5;
   /* 280 */ uint64 t6;
+  /* 288 */ uint64 pid;           // 进程的PID, 供uservec处理getpid
 };
 
+// 浮点寄存器状态, 布局与fpu.S对应
+struct fpstate {
+  /*   0 */ uint64 f[32];
+  /* 256 */ uint64 fcsr;
+};
+
+struct uring;
+
 // 进程状态
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
@@ -88,6 +114,27 @@ struct proc {
   struct trapframe *trapframe; // 指向trapframe页
   struct context context;      // 上下文切换时保存的寄存器
   char name[16];               // 进程名 (用于调试)
+  struct timer timer;          // 睡眠/等待的超时定时器
+  int timedout;                // 上一次等待是否因超时结束
+  int xstate;                  // 退出状态
+  struct list hash_link;       // PID哈希表中的链表节点
+  struct list rq_link;         // 运行队列或空闲链表中的链表节点
+  void (*kfn)(void *);         // 内核线程的入口函数, 用户进程为0
+  void *karg;                  // 内核线程入口函数的参数
+  int fp_used;                 // fpstate中是否有保存的浮点状态
+  struct fpstate fpstate;      // 被切换出去时保存的浮点寄存器
+  struct uring *uring;         // 异步系统调用队列 (uring.c)
+  int ipc_state;               // IPC等待状态, 见ipc.h
+  int ipc_partner;             // 等待接收或回复的对方PID
+  int ipc_from;                // 收到的消息的发送方, -1表示失败
+  uint64 ipc_msg[IPC_MSG_WORDS]; // 排队等待发送的消息
+  struct list ipc_sendq;       // 等待本进程接收或回复的进程
+  struct list ipc_link;        // 在对方ipc_sendq上的链表节点
+  struct sched_info sched_info; // 调度统计 (schedstat.c)
+  struct rcu_head rcu;         // 延迟释放 (free_proc)
+  uint64 perf_count[PERF_SLOTS]; // 在各性能计数器上的计数 (perf.c)
+  uint32 perf_gen[PERF_SLOTS];   // perf_count对应的打开次数, 不一致时作废
+  uint8 perf_refs[PERF_SLOTS];   // 本进程打开各槽的次数, 释放时关闭
 };
 
 #endif // __PROC_H
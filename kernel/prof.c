@@ -0,0 +1,204 @@
+// 采样分析器 (prof.c)
+//
+// 开启后时钟按采样周期额外中断一次(timer_rearm把prof_next算进期限),
+// 陷入处理在timer_intr之前调用prof_tick, 记录被中断的pc、模式和当前PID,
+// 可选沿帧指针回溯调用栈。样本写入每个hart的缓冲区, 满了之后丢弃并计数。
+//
+// 输出格式, 每行一个样本, 地址都是十六进制, 调用栈从内到外:
+//   @PROF hz=<采样频率> samples=<样本数> lost=<丢弃数>
+//   @P <pid> <u|k> <pc> <返回地址> ...
+//   @PROF-END
+// tools/prof2folded.py对照kernel.elf符号化, 输出火焰图的折叠栈格式。
+//
+// 帧布局: 编译时保留帧指针(-fno-omit-frame-pointer), fp-8处是返回地址,
+// fp-16处是上一帧的fp。
+
+#include "types.h"
+#include "paging.h"
+#include "proc.h"
+#include "timer.h"
+#include "global_func.h"
+#include "memlayout.h"
+
+#define NCPU (sizeof(cpus) / sizeof(cpus[0]))
+
+#define PROF_SAMPLES 2048  // 每个hart的样本数
+#define PROF_DEPTH 8       // 回溯的最大深度, 不含pc本身
+#define PROF_PERIOD_US 1000
+#define PROF_PERIOD_MIN_US 100     // 更短的周期会让时钟中断占满CPU
+#define PROF_PERIOD_MAX_US 1000000
+
+struct prof_sample {
+  uint64 pc;
+  uint32 pid;
+  uint8 user;
+  uint8 depth;            // stack中有效的返回地址数
+  uint16 pad;
+  uint64 stack[PROF_DEPTH];
+};
+
+struct prof_buf {
+  uint64 n;               // 已记录的样本数
+  uint64 lost;            // 缓冲区满而丢弃的样本数
+  struct prof_sample samples[PROF_SAMPLES];
+};
+
+static struct prof_buf prof_bufs[NCPU];
+static uint64 prof_period;  // 采样周期, time CSR的计数
+static int prof_callchain;  // 是否回溯调用栈
+
+// 内核栈回溯。fp是kerneltrap自己的帧, 它的上一帧fp就是被中断的
+// 函数的s0(kernelvec不修改s0), 返回地址指向kernelvec, 跳过。
+// 只在fp所在的那一页栈内回溯, 帧指针损坏时不会越界访问。
+static int
+prof_walk_kernel(uint64 fp, uint64 *stack)
+{
+  uint64 lo = PGROUNDDOWN(fp), hi = lo + PGSIZE;
+  int n = 0;
+
+  fp = *(uint64 *)(fp - 16);
+  while(n < PROF_DEPTH && fp > lo + 16 && fp <= hi && (fp & 7) == 0){
+    uint64 ra = *(uint64 *)(fp - 8);
+    if(ra == 0)
+      break;
+    stack[n++] = ra;
+    fp = *(uint64 *)(fp - 16);
+  }
+  return n;
+}
+
+// 用户栈回溯, 从trapframe中的s0开始, 用copyin读取, 不会缺页
+static int
+prof_walk_user(struct proc *p, uint64 *stack)
+{
+  uint64 fp = p->trapframe->s0;
+  uint64 frame[2]; // {上一帧fp, 返回地址}
+  int n = 0;
+
+  while(n < PROF_DEPTH && fp >= 16 && fp < p->sz && (fp & 7) == 0){
+    if(copyin(p->pagetable, (char *)frame, fp - 16, sizeof(frame)) < 0)
+      break;
+    if(frame[1] == 0)
+      break;
+    stack[n++] = frame[1];
+    if(frame[0] <= fp)  // 栈向低地址增长, 上一帧的fp一定更高
+      break;
+    fp = frame[0];
+  }
+  return n;
+}
+
+// 记录一个样本。在中断上半部中调用, 计数器溢出中断(perf.c)也用它。
+void
+prof_sample(uint64 pc, int user, uint64 fp)
+{
+  struct cpu *c = mycpu();
+  struct prof_buf *b = &prof_bufs[c - cpus];
+  struct prof_sample *s;
+
+  if(b->n >= PROF_SAMPLES){
+    b->lost++;
+    return;
+  }
+  s = &b->samples[b->n++];
+  s->pc = pc;
+  s->pid = c->proc ? c->proc->pid : 0;
+  s->user = user;
+  s->depth = 0;
+  if(prof_callchain)
+    s->depth = user ? prof_walk_user(c->proc, s->stack) : prof_walk_kernel(fp, s->stack);
+}
+
+// 时钟中断的上半部中, 在timer_intr之前调用。
+// 到了采样时刻时记录一个样本, 并推进下一次采样的时刻。
+void
+prof_tick(uint64 pc, int user, uint64 fp)
+{
+  struct cpu *c = mycpu();
+  uint64 now = r_time();
+
+  if(c->prof_next == 0 || now < c->prof_next)
+    return;
+  // 错过的周期不补采样
+  c->prof_next += prof_period * ((now - c->prof_next) / prof_period + 1);
+  prof_sample(pc, user, fp);
+}
+
+// 开始按时间采样, 周期为period_us微秒(0为默认的1ms, 限制在
+// [PROF_PERIOD_MIN_US, PROF_PERIOD_MAX_US]之内), callchain为1时回溯调用栈。
+// 之前的样本被清空。成功返回0。
+int
+prof_start(uint64 period_us, int callchain)
+{
+  struct cpu *c = mycpu();
+  uint64 period;
+
+  if(period_us == 0)
+    period_us = PROF_PERIOD_US;
+  else if(period_us < PROF_PERIOD_MIN_US)
+    period_us = PROF_PERIOD_MIN_US;
+  else if(period_us > PROF_PERIOD_MAX_US)
+    period_us = PROF_PERIOD_MAX_US;
+  if((period = US2CYCLES(period_us)) == 0)
+    return -1;
+
+  push_off();
+  prof_period = period;
+  prof_callchain = callchain;
+  for(int h = 0; h < NCPU; h++){
+    prof_bufs[h].n = 0;
+    prof_bufs[h].lost = 0;
+  }
+  c->prof_next = r_time() + prof_period;
+  // 空闲的hart上可能没有更早的期限, 立即按新的采样时刻编程
+  timer_rearm();
+  pop_off();
+  return 0;
+}
+
+// 停止采样, 返回1表示之前在采样
+int
+prof_stop(void)
+{
+  struct cpu *c = mycpu();
+  int on;
+
+  push_off();
+  on = c->prof_next != 0;
+  c->prof_next = 0;
+  pop_off();
+  return on;
+}
+
+// 把样本输出到控制台。与trace_dump一样绕过日志环,
+// 只能在进程上下文中、停止采样之后调用。
+void
+prof_dump(void)
+{
+  char line[64];
+  uint64 total = 0, lost = 0;
+  int n;
+
+  for(int h = 0; h < NCPU; h++){
+    total += prof_bufs[h].n;
+    lost += prof_bufs[h].lost;
+  }
+  n = snprintf(line, sizeof(line), "@PROF hz=%lu samples=%lu lost=%lu\n",
+               prof_period ? TIMER_FREQ / prof_period : 0, total, lost);
+  console_write(line, n);
+
+  for(int h = 0; h < NCPU; h++){
+    struct prof_buf *b = &prof_bufs[h];
+    for(uint64 i = 0; i < b->n; i++){
+      struct prof_sample *s = &b->samples[i];
+      n = snprintf(line, sizeof(line), "@P %d %c %lx", s->pid, s->user ? 'u' : 'k', s->pc);
+      console_write(line, n);
+      for(int d = 0; d < s->depth; d++){
+        n = snprintf(line, sizeof(line), " %lx", s->stack[d]);
+        console_write(line, n);
+      }
+      console_write("\n", 1);
+    }
+  }
+  console_write("@PROF-END\n", 10);
+}
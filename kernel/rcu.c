@@ -0,0 +1,179 @@
+// 读多写少的同步: 基于静止状态的RCU (rcu.c)
+//
+// 读者用rcu_read_lock/rcu_read_unlock标出读侧临界区, 期间不能睡眠,
+// 也不会被抢占; 读侧只修改本核的一个计数器, 不写任何共享的缓存行。
+// 关中断的区间(push_off)同样是读侧临界区。
+//
+// 写者修改数据结构(lst_remove_rcu, rcu_assign_pointer)之后,
+// 用call_rcu延迟释放旧对象: 等每个核都经过一次静止状态
+// (上下文切换、调度器空闲循环), 即一个宽限期之后, 之前开始的读者
+// 都已结束, 这时才在RCU_SOFTIRQ中执行回调。
+//
+// 回调分两批: wait批在等待当前宽限期, next批是宽限期开始后新加入的,
+// 要等下一个宽限期。
+
+#include "types.h"
+#include "paging.h"
+#include "proc.h"
+#include "rcu.h"
+#include "wait.h"
+#include "global_func.h"
+
+#define NCPU (sizeof(cpus) / sizeof(cpus[0]))
+
+static struct spinlock rcu_lock;
+static struct rcu_head *next_list, **next_tail = &next_list; // 等下一个宽限期
+static struct rcu_head *wait_list, **wait_tail = &wait_list; // 等当前宽限期
+static struct rcu_head *done_list, **done_tail = &done_list; // 可以执行
+static uint64 qs_mask;      // 当前宽限期中还没经过静止状态的核
+static uint64 gp_seq;       // 已完成的宽限期数
+static int gp_active;       // 是否有宽限期在进行
+static int rcu_active;      // 调度器是否已开始运行, 之前没有读者被切换出去
+
+static void
+rcu_gp_start(void)
+{
+  if(gp_active || next_list == 0)
+    return;
+  wait_list = next_list;
+  wait_tail = next_tail;
+  next_list = 0;
+  next_tail = &next_list;
+  qs_mask = (1UL << NCPU) - 1;
+  gp_active = 1;
+}
+
+static void
+rcu_gp_end(void)
+{
+  *done_tail = wait_list;
+  done_tail = wait_tail;
+  wait_list = 0;
+  wait_tail = &wait_list;
+  gp_active = 0;
+  gp_seq++;
+  rcu_gp_start();
+  raise_softirq(RCU_SOFTIRQ);
+}
+
+// 读侧临界区开始, 可以嵌套
+void
+rcu_read_lock(void)
+{
+  mycpu()->rcu_nesting++;
+  __sync_synchronize();
+}
+
+void
+rcu_read_unlock(void)
+{
+  __sync_synchronize();
+  if(--mycpu()->rcu_nesting < 0)
+    panic("rcu_read_unlock");
+}
+
+// 当前核是否在读侧临界区中, 这时不能抢占
+int
+rcu_read_locked(void)
+{
+  return mycpu()->rcu_nesting > 0;
+}
+
+// 当前核经过了一个静止状态。在上下文切换和调度器循环中调用, 需已关中断。
+void
+rcu_qs(void)
+{
+  uint64 bit = 1UL << (mycpu() - cpus);
+
+  if((qs_mask & bit) == 0)
+    return;
+  acquire(&rcu_lock);
+  if(gp_active && (qs_mask & bit)){
+    qs_mask &= ~bit;
+    if(qs_mask == 0)
+      rcu_gp_end();
+  }
+  release(&rcu_lock);
+}
+
+// 宽限期之后调用head->func(head)。回调在软中断中执行, 不能睡眠。
+void
+call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *))
+{
+  head->func = func;
+  head->next = 0;
+
+  // 启动阶段没有任何进程被切换出去, 不可能有读者残留
+  if(!rcu_active){
+    func(head);
+    return;
+  }
+  acquire(&rcu_lock);
+  *next_tail = head;
+  next_tail = &head->next;
+  rcu_gp_start();
+  release(&rcu_lock);
+}
+
+static void
+rcu_softirq(void)
+{
+  struct rcu_head *list, *h;
+
+  acquire(&rcu_lock);
+  list = done_list;
+  done_list = 0;
+  done_tail = &done_list;
+  release(&rcu_lock);
+
+  while(list){
+    h = list;
+    list = h->next;
+    h->func(h);
+  }
+}
+
+// synchronize_rcu使用的回调
+struct rcu_sync {
+  struct rcu_head head;
+  int done;
+};
+
+static void
+rcu_sync_done(struct rcu_head *head)
+{
+  struct rcu_sync *rs = lst_entry(head, struct rcu_sync, head);
+
+  rs->done = 1;
+  wakeup(rs);
+}
+
+// 睡眠直到一个完整的宽限期结束。不能在读侧临界区中调用。
+void
+synchronize_rcu(void)
+{
+  struct rcu_sync rs;
+
+  if(!rcu_active)
+    return;
+  rs.done = 0;
+  call_rcu(&rs.head, rcu_sync_done);
+  push_off();
+  while(!rs.done)
+    sleep(&rs);
+  pop_off();
+}
+
+// 调度器开始运行时调用
+void
+rcu_start(void)
+{
+  rcu_active = 1;
+}
+
+void
+rcu_init(void)
+{
+  initlock(&rcu_lock, "rcu");
+  open_softirq(RCU_SOFTIRQ, rcu_softirq);
+}
@@ -0,0 +1,39 @@
+#ifndef __RCU_H
+#define __RCU_H
+
+#include "types.h"
+#include "list.h"
+
+// 延迟回调, 嵌入到要延迟释放的对象中
+struct rcu_head {
+  struct rcu_head *next;
+  void (*func)(struct rcu_head *head);
+};
+
+// 读者读取由rcu_assign_pointer发布的指针。
+// RISC-V的访存顺序保证地址依赖的读不会乱序, 不需要fence。
+#define rcu_dereference(p) (*(__typeof__(p) volatile *)&(p))
+
+// 写者发布指针: 之前对对象的初始化必须先于指针对读者可见
+#define rcu_assign_pointer(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+// 把e插入到lst之后, 读者在任何时刻看到的都是一个完整的链表
+static inline void
+lst_push_rcu(struct list *lst, struct list *e)
+{
+  e->next = lst->next;
+  e->prev = lst;
+  rcu_assign_pointer(lst->next, e);
+  e->next->prev = e;
+}
+
+// 删除e但保留e->next, 正在e上的读者还能继续向后遍历。
+// e要等宽限期之后才能重用。
+static inline void
+lst_remove_rcu(struct list *e)
+{
+  e->prev->next = e->next;
+  e->next->prev = e->prev;
+}
+
+#endif // __RCU_H
@@ -6,11 +6,72 @@
 // RISC-V SBI 调用封装
 
 // SBI扩展ID (EID)
+#define SBI_EID_BASE 0x10       // Base Extension
 #define SBI_EID_TIME 0x54494D45 // Timer Extension
+#define SBI_EID_PMU  0x504D55   // Performance Monitoring Unit Extension
 
 // SBI函数ID (FID)
+#define SBI_FID_PROBE_EXT 3     // BASE: 扩展是否存在
 #define SBI_FID_SET_TIMER 0
 
+// PMU扩展的函数
+#define SBI_PMU_NUM_COUNTERS    0
+#define SBI_PMU_COUNTER_INFO    1
+#define SBI_PMU_CONFIG_MATCHING 2
+#define SBI_PMU_COUNTER_START   3
+#define SBI_PMU_COUNTER_STOP    4
+
+// counter_config_matching的flags
+#define SBI_PMU_CFG_SKIP_MATCH  (1 << 0)
+#define SBI_PMU_CFG_CLEAR_VALUE (1 << 1)
+#define SBI_PMU_CFG_AUTO_START  (1 << 2)
+#define SBI_PMU_CFG_SET_MINH    (1 << 7) // M模式下不计数
+// counter_start的flags
+#define SBI_PMU_START_SET_INIT_VALUE (1 << 0)
+// counter_stop的flags
+#define SBI_PMU_STOP_RESET (1 << 0)
+
+// counter_get_info返回值的字段
+#define SBI_PMU_INFO_CSR(x)   ((x) & 0xfff)
+#define SBI_PMU_INFO_WIDTH(x) ((((x) >> 12) & 0x3f) + 1)
+#define SBI_PMU_INFO_FW(x)    ((x) >> 63)
+
+// SBI v0.2之后的调用返回错误码和值两个寄存器
+struct sbiret {
+  long error;
+  long value;
+};
+
+static inline struct sbiret
+sbi_ecall(uint64 eid, uint64 fid, uint64 arg0, uint64 arg1, uint64 arg2,
+          uint64 arg3, uint64 arg4)
+{
+    struct sbiret ret;
+    register uint64 a0 asm("a0") = arg0;
+    register uint64 a1 asm("a1") = arg1;
+    register uint64 a2 asm("a2") = arg2;
+    register uint64 a3 asm("a3") = arg3;
+    register uint64 a4 asm("a4") = arg4;
+    register uint64 a6 asm("a6") = fid;
+    register uint64 a7 asm("a7") = eid;
+
+    asm volatile(
+        "ecall"
+        : "+r"(a0), "+r"(a1)
+        : "r"(a2), "r"(a3), "r"(a4), "r"(a6), "r"(a7)
+        : "memory"
+    );
+    ret.error = a0;
+    ret.value = a1;
+    return ret;
+}
+
+// 扩展eid是否存在
+static inline int sbi_probe_extension(uint64 eid) {
+    struct sbiret r = sbi_ecall(SBI_EID_BASE, SBI_FID_PROBE_EXT, eid, 0, 0, 0, 0);
+    return r.error == 0 && r.value != 0;
+}
+
 // 通用的SBI调用函数
 static inline uint64 sbi_call(uint64 eid, uint64 fid, uint64 arg0, uint64 arg1, uint64 arg2) {
     uint64 ret;
@@ -0,0 +1,140 @@
+// 调度延迟与运行时间统计 (schedstat.c)
+//
+// 所有时间都直接读time CSR, 一次统计只是几次加法,
+// 可以一直开着。全局延迟按log2分桶, 只需要一个固定大小的数组,
+// 用来观察长尾: 平均值很小但偶尔有几毫秒的延迟, 在分布的高位桶里一眼可见。
+// 调用者都已关中断。
+
+#include "types.h"
+#include "paging.h"
+#include "proc.h"
+#include "schedstat.h"
+#include "global_func.h"
+
+static struct sched_snapshot stats;
+
+static int
+hist_bucket(uint64 v)
+{
+  int b = 0;
+
+  while(v > 1 && b < SCHED_HIST_BUCKETS - 1){
+    v >>= 1;
+    b++;
+  }
+  return b;
+}
+
+// p进入运行队列
+void
+sched_stat_enqueue(struct proc *p, int wakeup)
+{
+  p->sched_info.last_queued = r_time();
+  p->sched_info.woken = wakeup;
+  if(wakeup)
+    p->sched_info.nr_wakeups++;
+}
+
+// p开始运行。direct表示由proc_switch_to直接切换, 没有经过运行队列。
+void
+sched_stat_dispatch(struct proc *p, int direct)
+{
+  struct sched_info *si = &p->sched_info;
+  uint64 now = r_time();
+  uint64 wait;
+
+  stats.nr_switches++;
+  if(direct){
+    // 直接切换相当于唤醒后立即运行
+    stats.nr_direct++;
+    si->nr_wakeups++;
+    stats.wakeup_lat[0]++;
+  } else {
+    wait = now - si->last_queued;
+    si->wait_time += wait;
+    stats.runq_wait[hist_bucket(wait)]++;
+    if(si->woken){
+      si->wakeup_lat_sum += wait;
+      if(wait > si->wakeup_lat_max)
+        si->wakeup_lat_max = wait;
+      stats.wakeup_lat[hist_bucket(wait)]++;
+    }
+  }
+  si->last_run = now;
+}
+
+// p停止运行
+void
+sched_stat_out(struct proc *p)
+{
+  p->sched_info.run_time += r_time() - p->sched_info.last_run;
+  if(p->state == SLEEPING)
+    p->sched_info.nr_voluntary++;
+}
+
+// 调度器空闲了t
+void
+sched_stat_idle(uint64 t)
+{
+  stats.idle_time += t;
+}
+
+// schedstat(addr): 把全局统计的快照拷贝到用户地址addr
+int
+sched_stat_read(uint64 addr)
+{
+  struct sched_snapshot snap;
+
+  push_off();
+  snap = stats;
+  pop_off();
+  snap.now = r_time();
+  return copyout(myproc()->pagetable, addr, (char *)&snap, sizeof(snap));
+}
+
+// procstat(pid, addr): 把进程pid的统计拷贝到用户地址addr
+int
+sched_stat_read_proc(int pid, uint64 addr)
+{
+  struct sched_info si;
+  struct proc *p;
+
+  push_off();
+  if((p = find_proc(pid)) == 0){
+    pop_off();
+    return -1;
+  }
+  si = p->sched_info;
+  // 正在运行的进程加上本次已经运行的时间
+  if(p->state == RUNNING)
+    si.run_time += r_time() - si.last_run;
+  pop_off();
+  return copyout(myproc()->pagetable, addr, (char *)&si, sizeof(si));
+}
+
+static void
+hist_print(char *name, uint64 *h)
+{
+  int lo = SCHED_HIST_BUCKETS, hi = -1;
+
+  for(int i = 0; i < SCHED_HIST_BUCKETS; i++){
+    if(h[i]){
+      if(i < lo)
+        lo = i;
+      hi = i;
+    }
+  }
+  printf("%s:\n", name);
+  for(int i = lo; i <= hi; i++)
+    printf("  < %lu ns: %lu\n", (2UL << i) * (1000000000UL / TIMER_FREQ), h[i]);
+}
+
+// 打印全局统计, 调试用
+void
+sched_stat_print(void)
+{
+  printf("sched: %lu switches (%lu direct), idle %lu ms\n",
+         stats.nr_switches, stats.nr_direct, stats.idle_time / TICK_CYCLES);
+  hist_print("wakeup latency", stats.wakeup_lat);
+  hist_print("runq wait", stats.runq_wait);
+}
@@ -0,0 +1,34 @@
+#ifndef __SCHEDSTAT_H
+#define __SCHEDSTAT_H
+
+#include "types.h"
+
+// 调度统计 (schedstat.c)。时间的单位都是time CSR的计数 (100ns)。
+
+#define SCHED_HIST_BUCKETS 32 // 第i个桶统计[2^i, 2^(i+1))的延迟, 第0个桶包括0
+
+// 每个进程的调度统计, procstat系统调用原样拷贝给用户
+struct sched_info {
+  uint64 run_time;        // 累计运行时间
+  uint64 wait_time;       // 累计在运行队列中等待的时间
+  uint64 nr_voluntary;    // 主动让出CPU的次数 (睡眠、yield)
+  uint64 nr_involuntary;  // 时间片用完被抢占的次数
+  uint64 nr_wakeups;      // 被唤醒的次数
+  uint64 wakeup_lat_sum;  // 唤醒到开始运行的延迟之和
+  uint64 wakeup_lat_max;  // 唤醒到开始运行的最大延迟
+  uint64 last_queued;     // 最近一次进入运行队列的时刻
+  uint64 last_run;        // 最近一次开始运行的时刻
+  uint64 woken;           // 最近一次入队是否由唤醒引起
+};
+
+// 全局快照, schedstat系统调用拷贝给用户
+struct sched_snapshot {
+  uint64 now;                              // 快照时刻
+  uint64 nr_switches;                      // 进程切换总数
+  uint64 nr_direct;                        // 其中不经过调度器的直接切换
+  uint64 idle_time;                        // 调度器空闲(wfi)的总时间
+  uint64 wakeup_lat[SCHED_HIST_BUCKETS];   // 唤醒到运行的延迟分布
+  uint64 runq_wait[SCHED_HIST_BUCKETS];    // 每次在运行队列中等待时间的分布
+};
+
+#endif // __SCHEDSTAT_H
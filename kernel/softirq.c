@@ -0,0 +1,214 @@
+// 软中断与tasklet (softirq.c)
+//
+// 中断处理分为两半: 上半部在关中断的陷入处理中只做必须立即做的事
+// (应答设备、记录状态), 然后raise_softirq设置本核的挂起位;
+// 下半部在陷入返回前开中断执行。软中断处理期间又有新的软中断被挂起时
+// 最多重复SOFTIRQ_RESTART轮或SOFTIRQ_BUDGET_US微秒, 剩下的交给
+// ksoftirqd内核线程, 不让软中断无限占用被中断的进程。
+//
+// 同时统计上半部的耗时和push_off/pop_off关中断区间的长度,
+// 用来确认关中断的时间是有界的。
+
+#include "types.h"
+#include "paging.h"
+#include "proc.h"
+#include "timer.h"
+#include "softirq.h"
+#include "global_func.h"
+
+#define SOFTIRQ_RESTART 10
+#define SOFTIRQ_BUDGET_US 2000
+
+static void (*softirq_vec[NR_SOFTIRQS])(void);
+static struct proc *ksoftirqd;
+
+// tasklet链表, FIFO
+static struct tasklet *tasklet_head;
+static struct tasklet **tasklet_tail = &tasklet_head;
+
+// 关中断时间的统计, 单位为time CSR的计数
+static struct {
+  uint64 nirq;            // 上半部次数
+  uint64 top_total;       // 上半部总耗时
+  uint64 top_max;         // 上半部最长耗时
+  uint64 nsoftirq[NR_SOFTIRQS];
+  uint64 soft_total;      // 下半部总耗时 (开中断)
+  uint64 irqoff_max;      // 最长的push_off关中断区间
+  uint64 irqoff_max_ra;   // 该区间结束处pop_off的调用者
+} irq_stats;
+
+// 注册软中断nr的处理函数
+void
+open_softirq(int nr, void (*fn)(void))
+{
+  softirq_vec[nr] = fn;
+}
+
+// 挂起软中断nr。可以在中断上半部中调用。
+// 不在陷入中时(例如进程上下文中调度tasklet), 由ksoftirqd执行。
+void
+raise_softirq(int nr)
+{
+  struct cpu *c = mycpu();
+
+  push_off();
+  c->softirq_pending |= 1 << nr;
+  if(!c->in_irq && !c->in_softirq && ksoftirqd)
+    wakeup(&ksoftirqd);
+  pop_off();
+}
+
+// 执行挂起的软中断。调用时中断关闭, 返回时仍然关闭。
+static void
+do_softirq(void)
+{
+  struct cpu *c = mycpu();
+  uint64 start = r_time();
+  uint32 pending;
+  int restart = SOFTIRQ_RESTART;
+
+  if(c->in_softirq)
+    return;
+  c->in_softirq = 1;
+  while((pending = c->softirq_pending) != 0){
+    c->softirq_pending = 0;
+    intr_on();
+    for(int nr = 0; pending; nr++, pending >>= 1){
+      if((pending & 1) == 0)
+        continue;
+      irq_stats.nsoftirq[nr]++;
+      softirq_vec[nr]();
+    }
+    intr_off();
+    if(--restart == 0 || r_time() - start >= US2CYCLES(SOFTIRQ_BUDGET_US))
+      break;
+  }
+  irq_stats.soft_total += r_time() - start;
+  c->in_softirq = 0;
+  // 处理不完的交给ksoftirqd
+  if(c->softirq_pending && ksoftirqd)
+    wakeup(&ksoftirqd);
+}
+
+// 中断上半部开始, 在陷入处理中调用
+void
+irq_enter(void)
+{
+  struct cpu *c = mycpu();
+
+  c->in_irq = 1;
+  c->irq_start = r_time();
+}
+
+// 中断上半部结束: 统计耗时, 然后开中断执行挂起的下半部。
+// 中断处理中又被中断时(软中断处理期间)下半部由外层执行。
+void
+irq_exit(void)
+{
+  struct cpu *c = mycpu();
+  uint64 t = r_time() - c->irq_start;
+
+  irq_stats.nirq++;
+  irq_stats.top_total += t;
+  if(t > irq_stats.top_max)
+    irq_stats.top_max = t;
+  c->in_irq = 0;
+  if(c->noff == 0)
+    klog_wake();        // 上半部中写日志推迟的唤醒
+  if(c->softirq_pending && !c->in_softirq && c->noff == 0)
+    do_softirq();
+}
+
+// 当前是否在软中断处理中, 这时不能让出CPU
+int
+in_softirq(void)
+{
+  return mycpu()->in_softirq;
+}
+
+// pop_off结束一段关中断区间时调用
+void
+irqoff_account(uint64 t, uint64 ra)
+{
+  if(t > irq_stats.irqoff_max){
+    irq_stats.irqoff_max = t;
+    irq_stats.irqoff_max_ra = ra;
+  }
+}
+
+// 调度tasklet t, 可以在中断中调用
+void
+tasklet_schedule(struct tasklet *t)
+{
+  push_off();
+  if(!t->scheduled){
+    t->scheduled = 1;
+    t->next = 0;
+    *tasklet_tail = t;
+    tasklet_tail = &t->next;
+    raise_softirq(TASKLET_SOFTIRQ);
+  }
+  pop_off();
+}
+
+static void
+tasklet_action(void)
+{
+  struct tasklet *list, *t;
+
+  push_off();
+  list = tasklet_head;
+  tasklet_head = 0;
+  tasklet_tail = &tasklet_head;
+  pop_off();
+
+  while(list){
+    t = list;
+    list = t->next;
+    // 先清除标记, 执行期间可以再次调度自己
+    t->scheduled = 0;
+    t->func(t);
+  }
+}
+
+// 软中断过载或在进程上下文中被挂起时, 在这个线程中执行
+static void
+ksoftirqd_thread(void *arg)
+{
+  struct cpu *c = mycpu();
+
+  for(;;){
+    push_off();
+    while(c->softirq_pending == 0)
+      sleep(&ksoftirqd);
+    pop_off();
+    // 与irq_exit一样在noff为0时关中断调用, do_softirq内部会开中断
+    intr_off();
+    do_softirq();
+    intr_on();
+    yield();
+  }
+}
+
+// 打印中断统计, 调试用
+void
+irq_stat_print(void)
+{
+  printf("irq: %lu top halves, avg %lu ns, max %lu ns\n",
+         irq_stats.nirq,
+         irq_stats.nirq ? irq_stats.top_total * 100 / irq_stats.nirq : 0,
+         irq_stats.top_max * 100);
+  printf("softirq: timer %lu, tasklet %lu, total %lu us\n",
+         irq_stats.nsoftirq[TIMER_SOFTIRQ], irq_stats.nsoftirq[TASKLET_SOFTIRQ],
+         irq_stats.soft_total / 10);
+  printf("irqoff: max %lu ns at %p\n", irq_stats.irqoff_max * 100, irq_stats.irqoff_max_ra);
+}
+
+// 需要在proc_init之后调用
+void
+softirq_init(void)
+{
+  open_softirq(TASKLET_SOFTIRQ, tasklet_action);
+  if((ksoftirqd = kthread_create(ksoftirqd_thread, 0, "ksoftirqd")) == 0)
+    panic("softirq_init");
+}
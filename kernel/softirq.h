@@ -0,0 +1,30 @@
+#ifndef __SOFTIRQ_H
+#define __SOFTIRQ_H
+
+#include "types.h"
+
+// 软中断号, 数字小的先执行
+enum {
+  TIMER_SOFTIRQ,    // 时间轮到期处理 (timer.c)
+  TASKLET_SOFTIRQ,  // tasklet
+  RCU_SOFTIRQ,      // 宽限期结束后的RCU回调 (rcu.c)
+  NR_SOFTIRQS
+};
+
+// tasklet: 由中断上半部调度、在软中断中执行的一次性回调。
+// 同一个tasklet在执行前被多次调度只会执行一次。
+struct tasklet {
+  struct tasklet *next;
+  void (*func)(struct tasklet *t);
+  int scheduled;           // 已调度还未执行
+};
+
+static inline void
+tasklet_init(struct tasklet *t, void (*func)(struct tasklet *))
+{
+  t->next = 0;
+  t->func = func;
+  t->scheduled = 0;
+}
+
+#endif // __SOFTIRQ_H
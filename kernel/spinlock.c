@@ -0,0 +1,174 @@
+// 自旋锁 (spinlock.c)
+//
+// ticket锁: 获取者用amoadd.w取一个号, 然后等待owner轮到自己。
+//
+// 内存序: 取得锁的那次读是acquire (之后的访存不能提前到它前面,
+// 生成fence r,rw), 释放锁的那次写是release (之前的访存不能推迟到它后面,
+// 生成fence rw,w)。
+//
+// 持有锁期间关中断(push_off), 否则中断处理程序获取同一个锁会死锁。
+// 单核上关中断之后锁不会真的发生竞争, 但统计仍然能反映临界区有多长。
+
+#include "types.h"
+#include "paging.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "global_func.h"
+
+extern int klog_wake_pending;
+
+#if LOCK_STAT
+// 注册的锁, 用于lock_stat_print
+#define NLOCKSTAT 32
+static struct {
+  char *name;
+  struct lock_stat *stat;
+} lock_registry[NLOCKSTAT];
+static int nlockstat;
+
+static void
+lock_stat_register(char *name, struct lock_stat *st)
+{
+  if(nlockstat < NLOCKSTAT){
+    lock_registry[nlockstat].name = name;
+    lock_registry[nlockstat].stat = st;
+    nlockstat++;
+  }
+}
+
+static inline void
+lock_stat_acquired(struct lock_stat *st, uint64 t0, int contended)
+{
+  uint64 now = r_time();
+
+  st->nacquire++;
+  if(contended){
+    st->ncontended++;
+    st->spin += now - t0;
+  }
+  st->hold_start = now;
+}
+
+static inline void
+lock_stat_release(struct lock_stat *st)
+{
+  uint64 t = r_time() - st->hold_start;
+
+  if(t > st->hold_max)
+    st->hold_max = t;
+}
+#endif
+
+// ===== ticket锁 =====
+
+void
+initlock(struct spinlock *lk, char *name)
+{
+  lk->next = 0;
+  lk->owner = 0;
+  lk->name = name;
+  lk->cpu = 0;
+#if LOCK_STAT
+  memset(&lk->stat, 0, sizeof(lk->stat));
+  lock_stat_register(name, &lk->stat);
+#endif
+}
+
+void
+acquire(struct spinlock *lk)
+{
+  uint32 ticket;
+  int contended = 0;
+#if LOCK_STAT
+  uint64 t0 = r_time();
+#endif
+
+  push_off();
+  if(holding(lk))
+    panic("acquire");
+
+  ticket = __atomic_fetch_add(&lk->next, 1, __ATOMIC_RELAXED);
+  while(__atomic_load_n(&lk->owner, __ATOMIC_ACQUIRE) != ticket)
+    contended = 1;
+
+  lk->cpu = mycpu();
+#if LOCK_STAT
+  lock_stat_acquired(&lk->stat, t0, contended);
+#else
+  (void)contended;
+#endif
+}
+
+void
+release(struct spinlock *lk)
+{
+  if(!holding(lk))
+    panic("release");
+#if LOCK_STAT
+  lock_stat_release(&lk->stat);
+#endif
+  lk->cpu = 0;
+  // 只有持有者会写owner, 普通的读就够了
+  __atomic_store_n(&lk->owner, lk->owner + 1, __ATOMIC_RELEASE);
+  pop_off();
+}
+
+// 当前CPU是否持有锁lk, 调用时需已关中断
+int
+holding(struct spinlock *lk)
+{
+  return lk->owner != lk->next && lk->cpu == mycpu();
+}
+
+// ===== 关中断 =====
+
+// 关中断并记录嵌套深度, 与pop_off配对使用。
+// 最外层push_off记录之前的中断状态, 最后一个pop_off恢复它。
+void
+push_off(void)
+{
+  int old = intr_get();
+
+  intr_off();
+  if(mycpu()->noff == 0){
+    mycpu()->intena = old;
+    if(old)
+      mycpu()->irqoff_start = r_time();
+  }
+  mycpu()->noff += 1;
+}
+
+void
+pop_off(void)
+{
+  struct cpu *c = mycpu();
+
+  if(intr_get())
+    panic("pop_off - interruptible");
+  if(c->noff < 1)
+    panic("pop_off");
+  c->noff -= 1;
+  if(c->noff == 0 && c->intena){
+    irqoff_account(r_time() - c->irqoff_start, (uint64)__builtin_return_address(0));
+    intr_on();
+  }
+  // 离开最外层的关中断区间, 补上期间推迟的klogd唤醒
+  if(c->noff == 0 && !c->in_irq && klog_wake_pending)
+    klog_wake();
+}
+
+// 打印所有注册的锁的统计, 调试用
+void
+lock_stat_print(void)
+{
+#if LOCK_STAT
+  struct lock_stat *st;
+
+  for(int i = 0; i < nlockstat; i++){
+    st = lock_registry[i].stat;
+    printf("lock %s: acquire %lu, contended %lu, spin %lu us, hold max %lu us\n",
+           lock_registry[i].name, st->nacquire, st->ncontended,
+           st->spin / 10, st->hold_max / 10);
+  }
+#endif
+}
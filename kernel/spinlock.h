@@ -0,0 +1,33 @@
+#ifndef __SPINLOCK_H
+#define __SPINLOCK_H
+
+#include "types.h"
+#include "config.h" // 由Makefile生成
+
+// 为0时不收集锁统计, acquire/release中没有任何额外开销。
+// 默认关闭, 由Makefile的LOCK_STAT选项打开(写在config.h中)。
+#ifndef LOCK_STAT
+#define LOCK_STAT 0
+#endif
+
+// 单个锁的统计, 时间的单位为time CSR的计数
+struct lock_stat {
+  uint64 nacquire;     // 获取次数
+  uint64 ncontended;   // 获取时锁已被占用的次数
+  uint64 spin;         // 自旋等待的总时间
+  uint64 hold_max;     // 最长持有时间
+  uint64 hold_start;   // 本次获取的时刻
+};
+
+// 排队自旋锁(ticket lock): 按到达顺序获取, 不会饿死
+struct spinlock {
+  volatile uint32 next;   // 下一个发出的号
+  volatile uint32 owner;  // 当前持有者的号
+  char *name;
+  struct cpu *cpu;        // 持有锁的CPU
+#if LOCK_STAT
+  struct lock_stat stat;
+#endif
+};
+
+#endif // __SPINLOCK_H
@@ -1,46 +1,232 @@
 // 基础字符串操作 (string.c)
 
 #include "types.h"
+#include "paging.h"
+#include "memlayout.h"
+#include "global_func.h"
+
+// 大块内存的操作按8字节对齐后一次处理64字节; 启动时检测到V扩展后,
+// 不小于RVV_MIN字节的操作交给string_rvv.S中的向量版本。
+//
+// 内核不保存进程的向量寄存器, 所以用户态的sstatus.VS始终是Off:
+// 向量版本只在关中断的区间内临时打开VS, 用完立即关闭,
+// 中断处理程序也不会在其中间使用向量寄存器。
+
+#define RVV_MIN 256
+
+static int have_rvv;   // string_init检测到V扩展
+
+extern void memset_rvv(void *dst, int c, uint64 n);
+extern void memcpy_rvv(void *dst, const void *src, uint64 n);
+
+static inline void
+rvv_begin(void)
+{
+  push_off();
+  w_sstatus(r_sstatus() | SSTATUS_VS_INITIAL);
+}
+
+static inline void
+rvv_end(void)
+{
+  w_sstatus(r_sstatus() & ~SSTATUS_VS);
+  pop_off();
+}
 
 // 将dst指向的内存区域的前n个字节设置为值c
 void*
 memset(void *dst, int c, uint n)
 {
   char *cdst = (char *) dst;
-  for(uint i = 0; i < n; i++){
-    cdst[i] = c;
+  uint64 *w;
+  uint64 v;
+
+  if(have_rvv && n >= RVV_MIN){
+    rvv_begin();
+    memset_rvv(dst, c, n);
+    rvv_end();
+    return dst;
+  }
+
+  // 先逐字节写到8字节对齐
+  for(; n > 0 && ((uint64)cdst & 7); n--)
+    *cdst++ = c;
+
+  v = (uchar)c;
+  v |= v << 8;
+  v |= v << 16;
+  v |= v << 32;
+  w = (uint64 *)cdst;
+  for(; n >= 64; n -= 64, w += 8){
+    w[0] = v; w[1] = v; w[2] = v; w[3] = v;
+    w[4] = v; w[5] = v; w[6] = v; w[7] = v;
+  }
+  for(; n >= 8; n -= 8)
+    *w++ = v;
+
+  cdst = (char *)w;
+  while(n-- > 0)
+    *cdst++ = c;
+  return dst;
+}
+
+// 从前向后拷贝。每64字节先全部读出再写入, 所以d < s时即使重叠也正确。
+static void
+copy_forward(char *d, const char *s, uint64 n)
+{
+  // 只有源和目标对8取模相同时才能都对齐, 否则逐字节拷贝,
+  // 不依赖硬件(可能由固件模拟的)非对齐访问
+  if((((uint64)d ^ (uint64)s) & 7) == 0){
+    uint64 *wd, a0, a1, a2, a3, a4, a5, a6, a7;
+    const uint64 *ws;
+
+    for(; n > 0 && ((uint64)d & 7); n--)
+      *d++ = *s++;
+    wd = (uint64 *)d;
+    ws = (const uint64 *)s;
+    for(; n >= 64; n -= 64, wd += 8, ws += 8){
+      a0 = ws[0]; a1 = ws[1]; a2 = ws[2]; a3 = ws[3];
+      a4 = ws[4]; a5 = ws[5]; a6 = ws[6]; a7 = ws[7];
+      wd[0] = a0; wd[1] = a1; wd[2] = a2; wd[3] = a3;
+      wd[4] = a4; wd[5] = a5; wd[6] = a6; wd[7] = a7;
+    }
+    for(; n >= 8; n -= 8)
+      *wd++ = *ws++;
+    d = (char *)wd;
+    s = (const char *)ws;
+  }
+  while(n-- > 0)
+    *d++ = *s++;
+}
+
+// 从后向前拷贝, 用于s < d且重叠的情况
+static void
+copy_backward(char *d, const char *s, uint64 n)
+{
+  d += n;
+  s += n;
+  if((((uint64)d ^ (uint64)s) & 7) == 0){
+    uint64 *wd, a0, a1, a2, a3, a4, a5, a6, a7;
+    const uint64 *ws;
+
+    for(; n > 0 && ((uint64)d & 7); n--)
+      *--d = *--s;
+    wd = (uint64 *)d;
+    ws = (const uint64 *)s;
+    for(; n >= 64; n -= 64){
+      wd -= 8;
+      ws -= 8;
+      a0 = ws[0]; a1 = ws[1]; a2 = ws[2]; a3 = ws[3];
+      a4 = ws[4]; a5 = ws[5]; a6 = ws[6]; a7 = ws[7];
+      wd[0] = a0; wd[1] = a1; wd[2] = a2; wd[3] = a3;
+      wd[4] = a4; wd[5] = a5; wd[6] = a6; wd[7] = a7;
+    }
+    for(; n >= 8; n -= 8)
+      *--wd = *--ws;
+    d = (char *)wd;
+    s = (const char *)ws;
+  }
+  while(n-- > 0)
+    *--d = *--s;
+}
+
+// 拷贝n个字节, 源和目标不能重叠
+void*
+memcpy(void *dst, const void *src, uint n)
+{
+  if(have_rvv && n >= RVV_MIN){
+    rvv_begin();
+    memcpy_rvv(dst, src, n);
+    rvv_end();
+  } else {
+    copy_forward(dst, src, n);
   }
   return dst;
 }
 
 // 安全地拷贝n个字节, 能正确处理内存重叠的情况。
-//
-// 为什么需要memmove?
-// memcpy的行为在源和目标区域重叠时是未定义的, 这可能导致数据损坏。
-// memmove通过检查内存区域是否重叠来保证拷贝的正确性。
-//
-// 实现逻辑:
-// 1. 检测重叠: `if(s < d && s + n > d)`
-//    这个条件判断目标地址`d`是否在源地址`s`之后, 并且源和目标区域有重叠。
-//    - `s < d`: 目标在源之后。
-//    - `s + n > d`: 源的末尾超过了目标的开头, 意味着有重叠。
-// 2. 如果重叠, 从后向前拷贝:
-//    为了避免覆盖尚未拷贝的源数据, 我们从两个区域的末尾开始, 向前逐字节拷贝。
-// 3. 如果不重叠, 从前向后拷贝:
-//    这是最高效的拷贝方式。
+// 目标在源之后并且重叠时从后向前拷贝, 否则从前向后拷贝。
+// 向量版本每次先读入一整段再写出, 与copy_forward一样可以处理d < s的重叠。
 void*
 memmove(void *dst, const void *src, uint n)
 {
   const char *s = src;
   char *d = dst;
-  if(s < d && s + n > d){
-    s += n;
-    d += n;
-    while(n-- > 0)
-      *--d = *--s;
-  } else {
-    while(n-- > 0)
-      *d++ = *s++;
-  }
+
+  if(s < d && s + n > d)
+    copy_backward(d, s, n);
+  else
+    memcpy(d, s, n);
   return dst;
 }
+
+// 清零一个对齐的页
+void
+zero_page(void *pa)
+{
+  uint64 *w = pa;
+
+  if(have_rvv){
+    rvv_begin();
+    memset_rvv(pa, 0, PGSIZE);
+    rvv_end();
+    return;
+  }
+  for(int i = 0; i < PGSIZE / 8; i += 8){
+    w[i + 0] = 0; w[i + 1] = 0; w[i + 2] = 0; w[i + 3] = 0;
+    w[i + 4] = 0; w[i + 5] = 0; w[i + 6] = 0; w[i + 7] = 0;
+  }
+}
+
+// 拷贝一个对齐的页, 两页不能重叠
+void
+copy_page(void *dst, const void *src)
+{
+  if(have_rvv){
+    rvv_begin();
+    memcpy_rvv(dst, src, PGSIZE);
+    rvv_end();
+    return;
+  }
+  copy_forward(dst, src, PGSIZE);
+}
+
+// 检测V扩展: 打开sstatus.VS后读vlenb。没有V扩展时VS是只读的0,
+// 读vlenb触发非法指令异常。需要在trapinithart之后调用。
+void
+string_init(void)
+{
+  uint64 vlenb = 0;
+
+  w_sstatus(r_sstatus() | SSTATUS_VS_INITIAL);
+  csr_probe_start();
+  asm volatile("csrr %0, 0xc22" : "=r" (vlenb));
+  have_rvv = csr_probe_end() && vlenb != 0;
+  w_sstatus(r_sstatus() & ~SSTATUS_VS);
+  if(have_rvv)
+    printf("string: rvv, vlen %lu\n", vlenb * 8);
+}
+
+// 拷贝字符串, 最多n-1个字符, 保证以0结尾
+char*
+safestrcpy(char *s, const char *t, int n)
+{
+  char *os = s;
+
+  if(n <= 0)
+    return os;
+  while(--n > 0 && (*s++ = *t++) != 0)
+    ;
+  *s = 0;
+  return os;
+}
+
+int
+strlen(const char *s)
+{
+  int n;
+
+  for(n = 0; s[n]; n++)
+    ;
+  return n;
+}
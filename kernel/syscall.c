@@ -0,0 +1,125 @@
+// 系统调用分发 (syscall.c)
+//
+// 用户程序执行ecall, usertrap()调用syscall()。
+// 系统调用号在a7中, 参数在a0-a5中, 都直接从trapframe中取,
+// 返回值写回trapframe的a0。
+// getpid和gettime在trampoline.S的uservec中直接处理, 不保存全部寄存器,
+// 也不进入usertrap, 一般不会到这里。
+// 标记为SYSF_NOINTR的调用很短且不会睡眠, 在关中断的状态下直接处理,
+// 不开中断也不做抢占检查, 处理完立即返回用户态。
+
+#include "types.h"
+#include "proc.h"
+#include "syscall.h"
+#include "global_func.h"
+
+#define SYSF_NOINTR (1 << 0) // 关中断执行, 返回前不检查抢占
+
+// 取第n个系统调用参数的原始值
+uint64
+argraw(int n)
+{
+  struct trapframe *tf = myproc()->trapframe;
+
+  switch(n){
+  case 0: return tf->a0;
+  case 1: return tf->a1;
+  case 2: return tf->a2;
+  case 3: return tf->a3;
+  case 4: return tf->a4;
+  case 5: return tf->a5;
+  }
+  panic("argraw");
+  return -1;
+}
+
+int
+argint(int n)
+{
+  return (int)argraw(n);
+}
+
+uint64
+argaddr(int n)
+{
+  return argraw(n);
+}
+
+extern uint64 sys_exit(void);
+extern uint64 sys_getpid(void);
+extern uint64 sys_write(void);
+extern uint64 sys_yield(void);
+extern uint64 sys_sleep(void);
+extern uint64 sys_gettime(void);
+extern uint64 sys_settime(void);
+extern uint64 sys_uring_setup(void);
+extern uint64 sys_uring_enter(void);
+extern uint64 sys_futex_wait(void);
+extern uint64 sys_futex_wake(void);
+extern uint64 sys_ipc_send(void);
+extern uint64 sys_ipc_recv(void);
+extern uint64 sys_ipc_call(void);
+extern uint64 sys_ipc_reply(void);
+extern uint64 sys_ipc_replyrecv(void);
+extern uint64 sys_schedstat(void);
+extern uint64 sys_procstat(void);
+extern uint64 sys_read(void);
+extern uint64 sys_trace(void);
+extern uint64 sys_prof(void);
+extern uint64 sys_perf(void);
+
+struct syscall_desc {
+  uint64 (*fn)(void);
+  int flags;
+};
+
+static struct syscall_desc syscalls[] = {
+  [SYS_exit]    { sys_exit,    0 },
+  [SYS_getpid]  { sys_getpid,  SYSF_NOINTR },
+  [SYS_write]   { sys_write,   0 },
+  [SYS_yield]   { sys_yield,   0 },
+  [SYS_sleep]   { sys_sleep,   0 },
+  [SYS_gettime] { sys_gettime, SYSF_NOINTR },
+  [SYS_settime] { sys_settime, 0 },
+  [SYS_uring_setup] { sys_uring_setup, 0 },
+  [SYS_uring_enter] { sys_uring_enter, 0 },
+  [SYS_futex_wait] { sys_futex_wait, 0 },
+  [SYS_futex_wake] { sys_futex_wake, 0 },
+  [SYS_ipc_send] { sys_ipc_send, 0 },
+  [SYS_ipc_recv] { sys_ipc_recv, 0 },
+  [SYS_ipc_call] { sys_ipc_call, 0 },
+  [SYS_ipc_reply] { sys_ipc_reply, 0 },
+  [SYS_ipc_replyrecv] { sys_ipc_replyrecv, 0 },
+  [SYS_schedstat] { sys_schedstat, 0 },
+  [SYS_procstat] { sys_procstat, 0 },
+  [SYS_read]    { sys_read,    0 },
+  [SYS_trace]   { sys_trace,   0 },
+  [SYS_prof]    { sys_prof,    0 },
+  [SYS_perf]    { sys_perf,    0 },
+};
+
+#define NSYSCALL (sizeof(syscalls) / sizeof(syscalls[0]))
+
+// 分发系统调用, 返回1表示是SYSF_NOINTR的调用, 一直没有开中断
+int
+syscall(void)
+{
+  struct proc *p = myproc();
+  uint64 num = p->trapframe->a7;
+  struct syscall_desc *d;
+
+  if(num == 0 || num >= NSYSCALL || syscalls[num].fn == 0){
+    printf("%d %s: unknown sys call %d\n", p->pid, p->name, (int)num);
+    p->trapframe->a0 = -1;
+    return 1;
+  }
+  d = &syscalls[num];
+  if(d->flags & SYSF_NOINTR){
+    p->trapframe->a0 = d->fn();
+    return 1;
+  }
+  // 可能睡眠或耗时较长, 打开中断
+  intr_on();
+  p->trapframe->a0 = d->fn();
+  return 0;
+}
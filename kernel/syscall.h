@@ -0,0 +1,55 @@
+#ifndef __SYSCALL_H
+#define __SYSCALL_H
+
+// 系统调用号, 用户程序放在a7中, 参数放在a0-a5中, 返回值在a0中。
+// 这个文件也被用户态汇编包含, 只能有#define。
+#define SYS_exit     1
+#define SYS_getpid   2
+#define SYS_write    3
+#define SYS_yield    4
+#define SYS_sleep    5
+#define SYS_gettime  6
+#define SYS_settime  7
+#define SYS_uring_setup 8
+#define SYS_uring_enter 9
+#define SYS_futex_wait 10
+#define SYS_futex_wake 11
+#define SYS_ipc_send  12
+#define SYS_ipc_recv  13
+#define SYS_ipc_call  14
+#define SYS_ipc_reply 15
+#define SYS_ipc_replyrecv 16
+#define SYS_schedstat 17
+#define SYS_procstat  18
+#define SYS_read      19
+#define SYS_trace     20
+
+// trace(cmd, arg)的cmd
+#define TRACE_CMD_SET   0 // 设置开启的事件位图arg, 返回之前的位图
+#define TRACE_CMD_DUMP  1 // 把跟踪缓冲区输出到控制台并清空
+#define TRACE_CMD_RESET 2 // 清空跟踪缓冲区
+
+#define SYS_prof      21
+
+// prof(cmd, arg, callchain)的cmd
+#define PROF_CMD_START 0 // 开始采样, arg为周期(微秒, 0为默认, 限制在100us到1s), callchain为1时回溯调用栈
+#define PROF_CMD_STOP  1 // 停止采样
+#define PROF_CMD_DUMP  2 // 把样本输出到控制台
+
+#define SYS_perf      22
+
+// perf(cmd, a, b)的cmd
+#define PERF_CMD_OPEN  0 // 打开事件a, b不为0时每b个事件采样一次(需要Sscofpmf,
+                         // b至少为PERF_MIN_PERIOD), 返回槽号
+#define PERF_CMD_READ  1 // 调用进程在槽a上的计数
+#define PERF_CMD_CLOSE 2 // 关闭调用进程打开的槽a, 进程退出时自动关闭
+
+// SBI PMU的通用硬件事件编号, 其他事件直接传SBI的事件编号
+#define PERF_EV_CYCLES        0x1
+#define PERF_EV_INSTRUCTIONS  0x2
+#define PERF_EV_CACHE_REFS    0x3
+#define PERF_EV_CACHE_MISSES  0x4
+#define PERF_EV_BRANCHES      0x5
+#define PERF_EV_BRANCH_MISSES 0x6
+
+#endif // __SYSCALL_H
@@ -0,0 +1,233 @@
+// 进程、时间与控制台相关的系统调用 (sysproc.c)
+
+#include "types.h"
+#include "paging.h"
+#include "proc.h"
+#include "timer.h"
+#include "uring.h"
+#include "syscall.h"
+#include "global_func.h"
+
+#define WRITE_CHUNK 128 // sys_write每次从用户空间拷贝的字节数
+
+extern struct proc *initproc;
+
+uint64
+sys_exit(void)
+{
+  exit(argint(0));
+  return 0; // 不会到达
+}
+
+uint64
+sys_getpid(void)
+{
+  return myproc()->pid;
+}
+
+// write(fd, buf, n): 目前只支持标准输出/标准错误, 写到控制台
+uint64
+sys_write(void)
+{
+  struct proc *p = myproc();
+  int fd = argint(0);
+  uint64 buf = argaddr(1);
+  int n = argint(2);
+  char kbuf[WRITE_CHUNK + 1];
+  int done = 0;
+
+  if((fd != 1 && fd != 2) || n < 0)
+    return -1;
+  while(done < n){
+    int m = n - done;
+    if(m > WRITE_CHUNK)
+      m = WRITE_CHUNK;
+    if(copyin(p->pagetable, kbuf, buf + done, m) < 0)
+      return done > 0 ? done : -1;
+    kbuf[m] = 0;
+    console_write(kbuf, m);
+    done += m;
+  }
+  return done;
+}
+
+// read(fd, buf, n): 目前只支持标准输入, 从控制台按行读取
+uint64
+sys_read(void)
+{
+  int fd = argint(0);
+  int n = argint(2);
+
+  if(fd != 0 || n < 0)
+    return -1;
+  return console_read(argaddr(1), n);
+}
+
+uint64
+sys_yield(void)
+{
+  yield();
+  return 0;
+}
+
+// sleep(ms)
+uint64
+sys_sleep(void)
+{
+  int ms = argint(0);
+
+  if(ms < 0)
+    return -1;
+  sleep_until(r_time() + US2CYCLES((uint64)ms * 1000));
+  return 0;
+}
+
+// gettime(): 墙上时间 (纳秒)。
+// 用户态通常直接读VDSO时间页, 这个调用只是备用的慢路径。
+uint64
+sys_gettime(void)
+{
+  return vdso_gettime_kernel();
+}
+
+// settime(ns): 设置墙上时间。墙上时间是所有进程共享的, 只允许init设置。
+uint64
+sys_settime(void)
+{
+  if(myproc() != initproc)
+    return -1;
+  vdso_settime(argraw(0));
+  return 0;
+}
+
+// uring_setup(flags)
+uint64
+sys_uring_setup(void)
+{
+  return uring_setup(argint(0));
+}
+
+// uring_enter(to_submit, min_complete, flags)
+uint64
+sys_uring_enter(void)
+{
+  return uring_enter(argint(0), argint(1), argint(2));
+}
+
+// futex_wait(addr, expected, timeout_us)
+uint64
+sys_futex_wait(void)
+{
+  return futex_wait(argaddr(0), argint(1), argraw(2));
+}
+
+// futex_wake(addr, n)
+uint64
+sys_futex_wake(void)
+{
+  return futex_wake(argaddr(0), argint(1));
+}
+
+// IPC: 消息在a1-a4中, 见ipc.c
+
+// send(dest, m0, m1, m2, m3)
+uint64
+sys_ipc_send(void)
+{
+  return ipc_send(argint(0));
+}
+
+// recv(from) -> 发送方PID, 消息在a1-a4
+uint64
+sys_ipc_recv(void)
+{
+  return ipc_recv(argint(0));
+}
+
+// call(dest, m0, m1, m2, m3) -> 回复在a1-a4
+uint64
+sys_ipc_call(void)
+{
+  return ipc_call(argint(0));
+}
+
+// reply(dest, m0, m1, m2, m3)
+uint64
+sys_ipc_reply(void)
+{
+  return ipc_reply(argint(0));
+}
+
+// replyrecv(dest, m0, m1, m2, m3) -> 下一个请求的发送方PID
+uint64
+sys_ipc_replyrecv(void)
+{
+  return ipc_replyrecv(argint(0));
+}
+
+// schedstat(addr): 全局调度统计的快照 (struct sched_snapshot)
+uint64
+sys_schedstat(void)
+{
+  return sched_stat_read(argaddr(0));
+}
+
+// procstat(pid, addr): 进程的调度统计 (struct sched_info), pid为0表示自己
+uint64
+sys_procstat(void)
+{
+  int pid = argint(0);
+
+  return sched_stat_read_proc(pid ? pid : myproc()->pid, argaddr(1));
+}
+
+// trace(cmd, arg): 控制静态跟踪点, cmd见syscall.h
+uint64
+sys_trace(void)
+{
+  int cmd = argint(0);
+
+  switch(cmd){
+  case TRACE_CMD_SET:
+    return trace_set(argint(1));
+  case TRACE_CMD_DUMP:
+    trace_dump();
+    return 0;
+  case TRACE_CMD_RESET:
+    trace_reset();
+    return 0;
+  }
+  return -1;
+}
+
+// prof(cmd, arg, callchain): 控制采样分析器, cmd见syscall.h
+uint64
+sys_prof(void)
+{
+  switch(argint(0)){
+  case PROF_CMD_START:
+    return prof_start(argaddr(1), argint(2));
+  case PROF_CMD_STOP:
+    prof_stop();
+    return 0;
+  case PROF_CMD_DUMP:
+    prof_dump();
+    return 0;
+  }
+  return -1;
+}
+
+// perf(cmd, a, b): 硬件性能计数器, cmd见syscall.h
+uint64
+sys_perf(void)
+{
+  switch(argint(0)){
+  case PERF_CMD_OPEN:
+    return perf_open(argaddr(1), argaddr(2));
+  case PERF_CMD_READ:
+    return perf_read(argint(1));
+  case PERF_CMD_CLOSE:
+    return perf_close(argint(1));
+  }
+  return -1;
+}
@@ -0,0 +1,351 @@
+// 时钟中断、时间片与内核定时器 (timer.c)
+//
+// 没有周期性的tick: 每次时钟中断后, 根据下一个真正需要的期限
+// (当前进程时间片的结束时刻, 最早到期的定时器) 重新编程比较寄存器。
+// CPU空闲且没有定时器时, 调度器直接wfi, 不会被无意义地唤醒。
+//
+// 支持Sstc扩展时直接写stimecmp, 否则通过SBI ecall设置。
+//
+// 定时器挂在一个分层时间轮上 (类似Linux 4.8之后的timer wheel):
+// 每层64个槽, 第l层一个槽覆盖8^l个tick。定时器按距离到期的远近
+// 放入某一层, 到期时刻向上取整到该层的粒度, 之后不再级联迁移。
+// 插入和删除都是O(1); 每层一个64位的位图记录非空的槽,
+// 找最早到期的槽也只需要每层一次位运算, 与定时器数量无关。
+//
+// 时钟中断的上半部只检查时间片并挂起TIMER_SOFTIRQ,
+// 到期的定时器在软中断中开中断处理, 每个回调只在执行期间关中断。
+
+#include "types.h"
+#include "paging.h"
+#include "proc.h"
+#include "timer.h"
+#include "global_func.h"
+#include "sbi.h"
+
+#define TIMESLICE_US_DEFAULT 10000 // 默认时间片 10ms
+
+// 时间轮参数
+#define TW_LVL_BITS 6
+#define TW_LVL_SIZE (1 << TW_LVL_BITS)          // 每层的槽数
+#define TW_LVL_MASK (TW_LVL_SIZE - 1)
+#define TW_CLK_SHIFT 3                          // 每层粒度是下一层的8倍
+#define TW_DEPTH 6                              // 层数, 最远约34分钟
+#define TW_LVL_SHIFT(l) ((l) * TW_CLK_SHIFT)
+#define TW_LVL_GRAN(l) (1UL << TW_LVL_SHIFT(l)) // 第l层一个槽的粒度(tick)
+#define TW_LVL_RANGE(l) ((uint64)(TW_LVL_SIZE - 1) << TW_LVL_SHIFT(l))
+#define TW_EXPIRING (-2)                        // 已从槽中取出, 等待回调
+
+static int has_sstc;     // 是否可以直接写stimecmp
+static uint64 timeslice; // 时间片长度, 单位为time CSR的计数
+static uint64 armed;     // 当前编程的期限
+static int wheel_due;    // 已挂起TIMER_SOFTIRQ, 编程期限时不再考虑时间轮
+
+static struct list wheel[TW_DEPTH * TW_LVL_SIZE];
+static uint64 pending_map[TW_DEPTH]; // 每层一个位图, 标记非空的槽
+static uint64 wheel_clk;             // 下一个要处理的tick
+
+// ===== 位操作辅助函数 =====
+
+// 最低置位的位置, x不能为0
+static inline int
+ctz64(uint64 x)
+{
+  int n = 0;
+  if((x & 0xFFFFFFFF) == 0) { n += 32; x >>= 32; }
+  if((x & 0xFFFF) == 0) { n += 16; x >>= 16; }
+  if((x & 0xFF) == 0) { n += 8; x >>= 8; }
+  if((x & 0xF) == 0) { n += 4; x >>= 4; }
+  if((x & 0x3) == 0) { n += 2; x >>= 2; }
+  if((x & 0x1) == 0) { n += 1; }
+  return n;
+}
+
+// 循环右移
+static inline uint64
+ror64(uint64 x, int n)
+{
+  if(n == 0)
+    return x;
+  return (x >> n) | (x << (64 - n));
+}
+
+// ===== 时间轮 =====
+
+// 计算到期tick为expires的定时器应放入的槽
+static int
+tw_slot(uint64 expires)
+{
+  uint64 delta;
+  int lvl;
+
+  if(expires < wheel_clk)
+    expires = wheel_clk;
+  delta = expires - wheel_clk;
+  for(lvl = 0; lvl < TW_DEPTH - 1; lvl++)
+    if(delta < TW_LVL_RANGE(lvl))
+      break;
+  // 超出最高层范围的定时器放在最远的槽, 到时再重新插入
+  if(delta >= TW_LVL_RANGE(lvl))
+    expires = wheel_clk + TW_LVL_RANGE(lvl) - 1;
+  // 向上取整到该层的粒度, 保证不会提前到期
+  expires = (expires + TW_LVL_GRAN(lvl) - 1) >> TW_LVL_SHIFT(lvl);
+  return lvl * TW_LVL_SIZE + (expires & TW_LVL_MASK);
+}
+
+static void
+tw_enqueue(struct timer *t)
+{
+  int slot = tw_slot((t->expires + TICK_CYCLES - 1) / TICK_CYCLES);
+
+  t->slot = slot;
+  lst_push(&wheel[slot], &t->entry);
+  pending_map[slot / TW_LVL_SIZE] |= 1UL << (slot % TW_LVL_SIZE);
+}
+
+static void
+tw_dequeue(struct timer *t)
+{
+  lst_remove(&t->entry);
+  if(t->slot >= 0 && lst_empty(&wheel[t->slot]))
+    pending_map[t->slot / TW_LVL_SIZE] &= ~(1UL << (t->slot % TW_LVL_SIZE));
+  t->slot = -1;
+}
+
+// 最早需要处理的非空槽对应的tick, 没有定时器时返回TIMER_NEVER
+static uint64
+tw_next_tick(void)
+{
+  uint64 next = TIMER_NEVER;
+
+  for(int lvl = 0; lvl < TW_DEPTH; lvl++){
+    if(pending_map[lvl] == 0)
+      continue;
+    // 本层从wheel_clk起第一个按粒度对齐的位置
+    uint64 base = (wheel_clk + TW_LVL_GRAN(lvl) - 1) >> TW_LVL_SHIFT(lvl);
+    uint64 rot = ror64(pending_map[lvl], base & TW_LVL_MASK);
+    uint64 t = (base + ctz64(rot)) << TW_LVL_SHIFT(lvl);
+    if(t < next)
+      next = t;
+  }
+  return next;
+}
+
+// 空闲一段时间后wheel_clk会落后, 插入前把它推进到当前时刻,
+// 否则新定时器会按过大的距离放入粒度很粗的高层。
+static void
+tw_forward(uint64 now)
+{
+  uint64 next = tw_next_tick();
+
+  if(next < now)
+    now = next;
+  if(now > wheel_clk)
+    wheel_clk = now;
+}
+
+// 把第clk个tick到期的所有槽取出到list中。
+// 第l层的槽只在clk按该层粒度对齐时处理。
+static void
+tw_collect(uint64 clk, struct list *list)
+{
+  for(int lvl = 0; lvl < TW_DEPTH; lvl++){
+    int idx = (clk >> TW_LVL_SHIFT(lvl)) & TW_LVL_MASK;
+    int slot = lvl * TW_LVL_SIZE + idx;
+    if(pending_map[lvl] & (1UL << idx)){
+      while(!lst_empty(&wheel[slot])){
+        struct timer *t = (struct timer *)lst_pop(&wheel[slot]);
+        t->slot = TW_EXPIRING;
+        lst_push(list, &t->entry);
+      }
+      pending_map[lvl] &= ~(1UL << idx);
+    }
+    if(clk & (TW_LVL_GRAN(lvl + 1) - 1))
+      break;
+  }
+}
+
+// 处理now之前到期的所有定时器, 在TIMER_SOFTIRQ中调用。
+// 中间没有定时器的tick直接跳过, 空闲再久也只做常数次工作。
+// 只在操作时间轮和执行单个回调时关中断; 取出后还没执行的定时器
+// 标记为TW_EXPIRING, 期间仍然可以被timer_cancel取消。
+static void
+tw_run(uint64 now)
+{
+  struct list expired;
+  struct timer *t;
+  uint64 clk = 0;
+
+  lst_init(&expired);
+  for(;;){
+    push_off();
+    if(lst_empty(&expired)){
+      if(wheel_clk > now){
+        pop_off();
+        break;
+      }
+      clk = tw_next_tick();
+      if(clk > now){
+        wheel_clk = now + 1;
+        pop_off();
+        break;
+      }
+      tw_collect(clk, &expired);
+      wheel_clk = clk + 1;
+      pop_off();
+      continue;
+    }
+    t = (struct timer *)lst_pop(&expired);
+    t->slot = -1;
+    // 超出时间轮范围而被截断的定时器还没到期
+    if((t->expires + TICK_CYCLES - 1) / TICK_CYCLES > clk)
+      tw_enqueue(t);
+    else
+      t->func(t->arg);
+    pop_off();
+  }
+}
+
+// ===== 比较寄存器 =====
+
+// 写比较寄存器, time >= deadline 时触发S模式时钟中断。
+// 两种方式都会同时清除挂起的时钟中断。
+static void
+timer_program(uint64 deadline)
+{
+  armed = deadline;
+  if(has_sstc)
+    w_stimecmp(deadline);
+  else
+    sbi_set_timer(deadline);
+}
+
+// 根据当前CPU的状态和时间轮计算下一个期限并编程, 调用者已关中断
+void
+timer_rearm(void)
+{
+  struct cpu *c = mycpu();
+  uint64 deadline = TIMER_NEVER;
+  uint64 next = tw_next_tick();
+
+  if(c->proc)
+    deadline = c->slice_end;
+  if(c->prof_next && c->prof_next < deadline)
+    deadline = c->prof_next;
+  // 软中断还没处理到期的定时器, 现在编程它们只会立即再次中断
+  if(!wheel_due && next != TIMER_NEVER && next * TICK_CYCLES < deadline)
+    deadline = next * TICK_CYCLES;
+  timer_program(deadline);
+}
+
+// TIMER_SOFTIRQ的处理函数
+static void
+timer_softirq(void)
+{
+  tw_run(r_time() / TICK_CYCLES);
+  push_off();
+  wheel_due = 0;
+  timer_rearm();
+  pop_off();
+}
+
+// ===== 对外接口 =====
+
+// 设置时间片长度 (微秒)
+void
+timer_set_timeslice(uint64 us)
+{
+  if(us == 0)
+    panic("timer_set_timeslice");
+  timeslice = US2CYCLES(us);
+}
+
+// 探测Sstc扩展, 初始化时间轮并关闭时钟中断, 需要在trapinithart之后调用。
+// 固件没有打开menvcfg.STCE时访问stimecmp同样会触发非法指令异常,
+// 这种情况也按不支持处理。
+void
+timer_init(void)
+{
+  csr_probe_start();
+  r_stimecmp();
+  has_sstc = csr_probe_end();
+
+  for(int i = 0; i < TW_DEPTH * TW_LVL_SIZE; i++)
+    lst_init(&wheel[i]);
+  wheel_clk = r_time() / TICK_CYCLES;
+
+  open_softirq(TIMER_SOFTIRQ, timer_softirq);
+  timer_set_timeslice(TIMESLICE_US_DEFAULT);
+  timer_program(TIMER_NEVER);
+  printf("timer: %s, timeslice %d us\n",
+         has_sstc ? "sstc" : "sbi", TIMESLICE_US_DEFAULT);
+}
+
+// 启动定时器t, 在time CSR到达expires之后调用t->func。
+// t已经在等待时先取消, 相当于修改到期时刻。
+void
+timer_add(struct timer *t, uint64 expires)
+{
+  push_off();
+  if(timer_pending(t))
+    tw_dequeue(t);
+  t->expires = expires;
+  tw_forward(r_time() / TICK_CYCLES);
+  tw_enqueue(t);
+  // 比已编程的期限更早, 需要提前中断
+  if(expires < armed)
+    timer_rearm();
+  pop_off();
+}
+
+// 取消定时器。返回1表示取消前它还在等待。
+int
+timer_cancel(struct timer *t)
+{
+  int pending;
+
+  push_off();
+  pending = timer_pending(t);
+  if(pending)
+    tw_dequeue(t);
+  pop_off();
+  return pending;
+}
+
+// 调度器切换到一个进程之前调用, 开始新的时间片
+void
+timer_start_slice(void)
+{
+  mycpu()->slice_end = r_time() + timeslice;
+  mycpu()->need_resched = 0;
+  timer_rearm();
+}
+
+// 时钟中断的上半部。有定时器到期时挂起TIMER_SOFTIRQ。
+// 返回1表示当前进程的时间片已用完, 需要让出CPU。
+int
+timer_intr(void)
+{
+  struct cpu *c = mycpu();
+  uint64 now = r_time();
+  int expired = 0;
+
+  if(tw_next_tick() <= now / TICK_CYCLES){
+    wheel_due = 1;
+    raise_softirq(TIMER_SOFTIRQ);
+  }
+  if(c->proc && now >= c->slice_end){
+    expired = 1;
+    c->slice_end = TIMER_NEVER;
+  }
+  timer_rearm();
+  return expired;
+}
+
+// 调度器没有可运行进程时调用, 调用时必须关中断。
+// 编程下一个期限后wfi, 返回后由调用者开中断处理唤醒它的中断。
+void
+timer_idle(void)
+{
+  timer_rearm();
+  wfi();
+}
@@ -0,0 +1,40 @@
+#ifndef __TIMER_H
+#define __TIMER_H
+
+#include "types.h"
+#include "list.h"
+
+#define TIMER_FREQ 10000000UL // QEMU virt上time CSR的频率 (10MHz)
+#define TIMER_NEVER (~0UL)    // 没有期限
+
+// 时间轮的粒度: 1 tick = 1ms
+#define TICK_CYCLES (TIMER_FREQ / 1000)
+
+// 微秒转换为time CSR的计数
+#define US2CYCLES(us) ((uint64)(us) * (TIMER_FREQ / 1000000))
+
+// 内核定时器, 挂在timer.c的分层时间轮上。
+// 回调在TIMER_SOFTIRQ中关中断执行, 不能睡眠。
+struct timer {
+  struct list entry;       // 时间轮槽中的链表节点
+  uint64 expires;          // 到期时刻 (time CSR)
+  void (*func)(void *arg); // 到期回调
+  void *arg;
+  int slot;                // 所在的槽, -1表示没有挂在时间轮上
+};
+
+static inline void
+timer_setup(struct timer *t, void (*func)(void *), void *arg)
+{
+  t->func = func;
+  t->arg = arg;
+  t->slot = -1;
+}
+
+static inline int
+timer_pending(struct timer *t)
+{
+  return t->slot != -1;
+}
+
+#endif // __TIMER_H
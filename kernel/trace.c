@@ -0,0 +1,106 @@
+// 静态跟踪点的缓冲区 (trace.c)
+//
+// 每个hart一个环形缓冲区, 只由本hart写入。中断可能打断写到一半的记录,
+// 所以用原子加法领取槽位, 两条记录不会写到同一个槽位。
+// 输出时先关闭所有事件, 不与写入者并发。
+//
+// 输出格式, 每行一条, 数字都是十六进制:
+//   @TRACE hz=<time CSR频率> events=<事件名,...>
+//   @T <hart> <time> <event> <a0> <a1> <a2>
+//   @TRACE-END dropped=<被覆盖的记录数>
+
+#include "types.h"
+#include "paging.h"
+#include "proc.h"
+#include "trace.h"
+#include "global_func.h"
+
+#define NCPU (sizeof(cpus) / sizeof(cpus[0]))
+
+struct trace_buf {
+  uint64 idx;                           // 已写入的记录总数
+  struct trace_rec recs[TRACE_ENTRIES];
+};
+
+volatile uint32 trace_mask;
+static struct trace_buf trace_bufs[NCPU];
+
+static char *trace_names[NR_TRACE_EVENTS] = {
+  [TRACE_SWITCH]     "switch",
+  [TRACE_TRAP]       "trap",
+  [TRACE_TRAP_END]   "trap_end",
+  [TRACE_KMALLOC]    "kmalloc",
+  [TRACE_FREE_PAGE]  "free_page",
+  [TRACE_MAPPAGES]   "mappages",
+  [TRACE_ALLOC_PROC] "alloc_proc",
+};
+
+// 写入一条记录。不加锁, 可以在任何上下文中调用。
+void
+trace_emit(int ev, uint64 a0, uint64 a1, uint64 a2)
+{
+  int hart = mycpu() - cpus;
+  struct trace_buf *b = &trace_bufs[hart];
+  uint64 i = __atomic_fetch_add(&b->idx, 1, __ATOMIC_RELAXED);
+  struct trace_rec *r = &b->recs[i & (TRACE_ENTRIES - 1)];
+
+  r->time = r_time();
+  r->event = ev;
+  r->hart = hart;
+  r->a0 = a0;
+  r->a1 = a1;
+  r->a2 = a2;
+}
+
+// 设置开启的事件, 返回之前的设置
+uint32
+trace_set(uint32 mask)
+{
+  return __atomic_exchange_n(&trace_mask, mask & ((1U << NR_TRACE_EVENTS) - 1),
+                             __ATOMIC_SEQ_CST);
+}
+
+// 清空所有缓冲区
+void
+trace_reset(void)
+{
+  uint32 mask = trace_set(0);
+
+  for(int h = 0; h < NCPU; h++)
+    trace_bufs[h].idx = 0;
+  trace_set(mask);
+}
+
+// 把所有缓冲区按从旧到新输出到控制台, 然后清空。
+// 记录很多, 绕过日志环直接写串口缓冲区, 只能在进程上下文中调用。
+void
+trace_dump(void)
+{
+  char line[128];
+  uint32 mask = trace_set(0);
+  uint64 dropped = 0;
+  int n;
+
+  n = snprintf(line, sizeof(line), "@TRACE hz=%lu events=", TIMER_FREQ);
+  for(int ev = 0; ev < NR_TRACE_EVENTS; ev++)
+    n += snprintf(line + n, sizeof(line) - n, ev ? ",%s" : "%s", trace_names[ev]);
+  n += snprintf(line + n, sizeof(line) - n, "\n");
+  console_write(line, n);
+
+  for(int h = 0; h < NCPU; h++){
+    struct trace_buf *b = &trace_bufs[h];
+    uint64 i = b->idx > TRACE_ENTRIES ? b->idx - TRACE_ENTRIES : 0;
+
+    dropped += i;
+    for(; i < b->idx; i++){
+      struct trace_rec *r = &b->recs[i & (TRACE_ENTRIES - 1)];
+      n = snprintf(line, sizeof(line), "@T %x %lx %x %lx %lx %lx\n",
+                   r->hart, r->time, r->event, r->a0, r->a1, r->a2);
+      console_write(line, n);
+    }
+    b->idx = 0;
+  }
+  n = snprintf(line, sizeof(line), "@TRACE-END dropped=%lx\n", dropped);
+  console_write(line, n);
+  trace_set(mask);
+}
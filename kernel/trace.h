@@ -0,0 +1,48 @@
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#include "types.h"
+
+// 静态跟踪点 (trace.c)。
+//
+// TRACE(ev, a0, a1, a2)把一条定长的二进制记录写入当前hart的环形缓冲区,
+// 满了以后覆盖最旧的记录。每个事件可以在运行时单独开关,
+// 关闭时跟踪点只有一次load和一次分支。
+// 缓冲区以文本形式输出到控制台, 由tools/trace2json.py转换成
+// Chrome trace格式的时间线。
+
+// 事件号, 顺序与trace.c中的trace_names一致
+enum {
+  TRACE_SWITCH,     // 进程切换: a0=换出的PID(0为调度器), a1=换入的PID, a2=是否直接切换
+  TRACE_TRAP,       // 陷入开始: a0=scause, a1=sepc, a2=是否来自用户态
+  TRACE_TRAP_END,   // 陷入处理结束: a0=scause
+  TRACE_KMALLOC,    // 分配: a0=字节数, a1=返回的地址
+  TRACE_FREE_PAGE,  // 释放: a0=地址
+  TRACE_MAPPAGES,   // 建立映射: a0=va, a1=字节数, a2=pa
+  TRACE_ALLOC_PROC, // 分配进程: a0=PID
+  NR_TRACE_EVENTS
+};
+
+#define TRACE_ENTRIES 2048 // 每个hart的记录数, 必须是2的幂
+
+struct trace_rec {
+  uint64 time;      // time CSR
+  uint16 event;
+  uint16 hart;
+  uint32 pad;
+  uint64 a0;
+  uint64 a1;
+  uint64 a2;
+};
+
+extern volatile uint32 trace_mask; // 第ev位为1表示事件ev开启
+
+void trace_emit(int ev, uint64 a0, uint64 a1, uint64 a2);
+
+#define TRACE(ev, a0, a1, a2)                                             \
+  do {                                                                    \
+    if(__builtin_expect(trace_mask & (1U << (ev)), 0))                    \
+      trace_emit((ev), (uint64)(a0), (uint64)(a1), (uint64)(a2));         \
+  } while(0)
+
+#endif // __TRACE_H
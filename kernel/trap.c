@@ -3,11 +3,34 @@
 #include "types.h"
 #include "paging.h"
 #include "global_func.h"
-#include "sbi.h"
+#include "memlayout.h"
 
-// kernelvec.S 中断向量表的地址
+// kernelvec.S 内核态陷入的入口
 extern void kernelvec();
 
+// trampoline.S 用户态陷入的入口和返回代码
+extern char trampoline[], uservec[], userret[];
+
+// CSR探测: 访问不存在的CSR会触发非法指令异常。
+// 探测期间kerneltrap跳过该指令并记录失败, 而不是panic。
+static volatile int csr_probing;
+static volatile int csr_probe_failed;
+
+void
+csr_probe_start(void)
+{
+  csr_probe_failed = 0;
+  csr_probing = 1;
+}
+
+// 返回1表示探测期间访问的CSR存在
+int
+csr_probe_end(void)
+{
+  csr_probing = 0;
+  return !csr_probe_failed;
+}
+
 // 设置S模式下的中断处理
 void
 trapinithart(void)
@@ -22,30 +45,145 @@ trapinithart(void)
   w_sstatus(r_sstatus() | SSTATUS_SIE);
 }
 
+// 用户态中断/异常的处理入口, 由trampoline.S中的uservec跳转过来。
+// 此时已在内核页表和进程的内核栈上, 用户寄存器保存在p->trapframe中。
+void
+usertrap(void)
+{
+  struct proc *p = myproc();
+  uint64 scause = r_scause();
+  int preempt = 0;
+
+  TRACE(TRACE_TRAP, scause, r_sepc(), 1);
+  if((r_sstatus() & SSTATUS_SPP) != 0)
+    panic("usertrap: not from user mode");
+
+  // 现在在内核中, 之后的陷入交给kerneltrap
+  w_stvec((uint64)kernelvec);
+
+  p->trapframe->epc = r_sepc();
+
+  if (scause == 8) {
+    // 系统调用, 返回到ecall的下一条指令
+    p->trapframe->epc += 4;
+    // SYSF_NOINTR的调用没有开中断, 不检查抢占, 直接返回用户态
+    if (syscall()) {
+      usertrapret();
+      return;
+    }
+  } else if (scause & (1UL << 63)) {
+    irq_enter();
+    if ((scause & 0x7FFFFFFFFFFFFFFF) == 5) {
+      prof_tick(p->trapframe->epc, 1, 0);
+      preempt = timer_intr();
+    } else if ((scause & 0x7FFFFFFFFFFFFFFF) == 9) {
+      plic_dispatch();
+    } else if ((scause & 0x7FFFFFFFFFFFFFFF) == 13) {
+      perf_overflow_intr(p->trapframe->epc, 1, 0);
+    } else {
+      printf("usertrap: unhandled interrupt: scause %p pid=%d\n", scause, p->pid);
+      panic("usertrap");
+    }
+    // 开中断执行下半部
+    irq_exit();
+  } else if (scause == 2 && fp_trap()) {
+    // 已装入浮点状态, 返回后重新执行该指令
+  } else {
+    printf("usertrap: unexpected scause %p pid=%d\n", scause, p->pid);
+    printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
+    exit(-1);
+  }
+
+  if (preempt || mycpu()->need_resched)
+    yield_preempt();
+
+  usertrapret();
+}
+
+// 返回用户态
+void
+usertrapret(void)
+{
+  struct proc *p = myproc();
+  uint64 x;
+
+  // 马上要把stvec切换到uservec, 在回到用户态之前不能再有陷入
+  intr_off();
+  TRACE(TRACE_TRAP_END, r_scause(), 0, 0);
+
+  // 之后的陷入进入trampoline中的uservec
+  w_stvec(TRAMPOLINE + (uservec - trampoline));
+
+  // uservec再次陷入时需要的内核信息
+  p->trapframe->kernel_satp = r_satp();
+  p->trapframe->kernel_sp = p->kstack + PGSIZE;
+  p->trapframe->kernel_trap = (uint64)usertrap;
+  p->trapframe->kernel_hartid = r_tp();
+
+  // sret返回用户态(SPP=0), 并在用户态开中断(SPIE=1)
+  x = r_sstatus();
+  x &= ~SSTATUS_SPP;
+  x |= SSTATUS_SPIE;
+  w_sstatus(x);
+
+  w_sepc(p->trapframe->epc);
+
+  // 跳到trampoline中的userret, 它切换到用户页表, 恢复用户寄存器后sret
+  uint64 trampoline_userret = TRAMPOLINE + (userret - trampoline);
+  ((void (*)(uint64))trampoline_userret)(MAKE_SATP(p->pagetable));
+}
+
 // 内核态中断/异常的总处理入口
 void kerneltrap()
 {
   uint64 scause = r_scause();
   uint64 sepc = r_sepc();
+  uint64 sstatus = r_sstatus();
+  int preempt = 0;
 
+  TRACE(TRACE_TRAP, scause, sepc, 0);
   // 判断是中断还是异常
   if (scause & (1UL << 63)) { // 最高位为1, 表示是中断
     // 进一步判断中断类型, 这里我们只关心S模式时钟中断
+    irq_enter();
     if ((scause & 0x7FFFFFFFFFFFFFFF) == 5) {
-      // 是S模式的时钟中断
-      // 重新设置时钟中断 (10,000,000 apx. 1s on QEMU)
-      sbi_set_timer(r_time() + 10000000);
-
-      // 临时打印信息, 确认中断已收到
-      printf("timer interrupt!\n");
-
+      // 是S模式的时钟中断, 由timer.c重新编程下一个期限
+      prof_tick(sepc, 0, r_fp());
+      preempt = timer_intr();
+    } else if ((scause & 0x7FFFFFFFFFFFFFFF) == 9) {
+      // S模式外部中断, 来自PLIC
+      plic_dispatch();
+    } else if ((scause & 0x7FFFFFFFFFFFFFFF) == 13) {
+      // Sscofpmf计数器溢出, 用于按事件采样
+      perf_overflow_intr(sepc, 0, r_fp());
     } else {
       printf("unhandled interrupt: scause %p, sepc %p\n", scause, sepc);
       panic("kerneltrap");
     }
+  } else if (scause == 2 && csr_probing) { // 探测的CSR不存在
+    csr_probe_failed = 1;
+    w_sepc(sepc + 4); // csrr总是4字节指令
+  } else if (scause == 2 && fp_trap()) { // 浮点单元关闭时的浮点指令
+    // 已装入浮点状态, 返回后重新执行该指令
   } else { // 是异常
     printf("exception: scause %p, sepc %p\n", scause, sepc);
     panic("kerneltrap");
   }
-}
 
+  // 开中断执行下半部, 然后如果时间片用完就让出CPU。
+  // 软中断处理中和RCU读侧临界区中不能让出, 由外层的陷入返回时处理。
+  // 这期间的其他陷入会覆盖sepc和sstatus, 所以返回前要恢复它们。
+  // FS例外: 切换时浮点状态已被保存并关闭, 要保留当前的FS。
+  if (scause & (1UL << 63)) {
+    irq_exit();
+    if (in_softirq() || rcu_read_locked()) {
+      if (preempt)
+        mycpu()->need_resched = 1;
+    } else if ((preempt || mycpu()->need_resched) && myproc() != 0 &&
+             myproc()->state == RUNNING)
+      yield_preempt();
+    w_sepc(sepc);
+    w_sstatus((sstatus & ~SSTATUS_FS) | (r_sstatus() & SSTATUS_FS));
+  }
+  TRACE(TRACE_TRAP_END, scause, 0, 0);
+}
@@ -7,4 +7,7 @@ typedef unsigned short uint16;
 typedef unsigned int  uint32;
 typedef unsigned long uint64;
 
+typedef int  int32;
+typedef long int64;
+
 typedef uint64 pde_t;
@@ -1,13 +1,84 @@
+// UART驱动 (uart.c)
+//
+// 输出是中断驱动的: uart_putc只把字节放进发送环形缓冲区,
+// 发送FIFO空时UART产生中断, uart_intr一次向FIFO补充UART_FIFO_SIZE个字节。
+// 缓冲区满时才同步等待FIFO腾出空间, 不丢输出。
+// panic使用同步的轮询路径, 不依赖中断。
+
+#include "types.h"
+#include "paging.h"
+#include "spinlock.h"
+#include "global_func.h"
 #include "magic_values.h"
 #define ReadReg(reg) (*(Reg(reg)))
 #define WriteReg(reg, v) (*(Reg(reg)) = (v))
 
+#define UART_TX_BUF_SIZE 4096 // 发送缓冲区大小, 必须是2的幂
+#define UART_FIFO_SIZE 16     // 16550的发送FIFO深度
+
+static struct spinlock tx_lock;
+static char tx_buf[UART_TX_BUF_SIZE];
+static uint64 tx_w;            // 下一个写入的位置
+static uint64 tx_r;            // 下一个发送的位置
+static uint64 tx_full_waits;   // 缓冲区满而同步等待的次数
+volatile int panicked;         // panic之后其他输出不再进入缓冲区
+
+// 发送FIFO为空时, 从缓冲区向它填入最多UART_FIFO_SIZE个字节。
+// 调用者持有tx_lock。
+static void
+uart_start(void)
+{
+  if((ReadReg(LSR) & LSR_TX_IDLE) == 0)
+    return;
+  for(int i = 0; i < UART_FIFO_SIZE && tx_r != tx_w; i++){
+    WriteReg(THR, tx_buf[tx_r % UART_TX_BUF_SIZE]);
+    tx_r++;
+  }
+}
+
+// 把字节c放入发送缓冲区, 不等待发送完成。可以在中断中调用。
 void uart_putc(int c) {
+  if(panicked){
+    uart_putc_sync(c);
+    return;
+  }
+  acquire(&tx_lock);
+  while(tx_w - tx_r >= UART_TX_BUF_SIZE){
+    // 缓冲区满: 等FIFO发完后补充, 最多等一个FIFO的时间
+    tx_full_waits++;
+    while((ReadReg(LSR) & LSR_TX_IDLE) == 0)
+      ;
+    uart_start();
+  }
+  tx_buf[tx_w % UART_TX_BUF_SIZE] = c;
+  tx_w++;
+  uart_start();
+  release(&tx_lock);
+}
+
+// 同步输出一个字节, 轮询等待FIFO空闲。只在panic中使用。
+void uart_putc_sync(int c) {
   while((ReadReg(LSR) & LSR_TX_IDLE) == 0)
     ;
   WriteReg(THR, c);
 }
 
+// UART中断: 把收到的字节交给控制台, 然后继续发送缓冲区中的内容。
+// 读RHR清除接收中断, 读ISR清除发送空中断。
+void
+uart_intr(void)
+{
+  int c;
+
+  ReadReg(ISR);
+  while((c = uart_getc()) >= 0)
+    console_intr(c);
+
+  acquire(&tx_lock);
+  uart_start();
+  release(&tx_lock);
+}
+
 int uart_getc(void) {
   if(ReadReg(LSR) & LSR_RX_READY){
     return ReadReg(RHR);
@@ -24,26 +95,28 @@ void uart_puts(const char *s) {
   }
 }
 
-void panic(const char *s) {
-  uart_puts("panic: ");
-  uart_puts(s);
-  uart_puts("\n");
-  while(1);
+// 同步输出字符串, 只在panic中使用
+static void uart_puts_sync(const char *s) {
+  while(*s) {
+    if(*s == '\n')
+      uart_putc_sync('\r');
+    uart_putc_sync(*s++);
+  }
 }
 
-void uart_getstr(char *buf, int max) {
-  int i = 0;
-  while(i + 1 < max) {
-    int c = uart_getc();
-    if(c == -1)
-      continue;
-    if(c == '\r')
-      break;
-    uart_putc(c);
-    buf[i++] = c;
+// 关中断, 先把缓冲区和日志环中已有的输出同步发完, 再输出panic信息
+void panic(const char *s) {
+  intr_off();
+  panicked = 1;
+  while(tx_r != tx_w){
+    uart_putc_sync(tx_buf[tx_r % UART_TX_BUF_SIZE]);
+    tx_r++;
   }
-  buf[i] = 0;
-  uart_putc('\n');
+  klog_panic_flush();
+  uart_puts_sync("panic: ");
+  uart_puts_sync(s);
+  uart_puts_sync("\n");
+  while(1);
 }
 
 void
@@ -68,9 +141,10 @@ uart_init(void)
   // reset and enable FIFOs.
   WriteReg(FCR, FCR_FIFO_ENABLE | FCR_FIFO_CLEAR);
 
-  // enable transmit and receive interrupts.
-  WriteReg(IER, IER_TX_ENABLE | IER_RX_ENABLE);
+  initlock(&tx_lock, "uart");
+  console_init();
 
-  // 我们现在不使用中断驱动的 UART 输出
-  //initlock(&tx_lock, "uart");
+  // 打开发送和接收中断, 接收到的字节由uart_intr交给console.c
+  WriteReg(IER, IER_TX_ENABLE | IER_RX_ENABLE);
+  plic_register(UART0_IRQ, 1, uart_intr);
 }
\ No newline at end of file
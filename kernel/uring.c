@@ -0,0 +1,389 @@
+// 异步批量系统调用 (uring.c)
+//
+// 每个进程可以有一对与内核共享的提交/完成队列 (布局见uring.h)。
+// 一次uring_enter()处理提交队列中所有新的请求, 一个陷入完成多个操作;
+// 开启SQPOLL后由uring_poll内核线程持续轮询, 用户态完全不需要陷入,
+// 轮询线程空闲一段时间后睡眠, 并在sq.flags中告诉用户需要唤醒。
+// 异步操作(定时)在完成时由中断上下文写入完成队列并唤醒等待者。
+//
+// 轮询线程只在从poll_rings上取队列时关中断, 处理请求时开着中断;
+// 它正在处理的队列标记为polling, 进程退出时uring_exit把队列从
+// poll_rings上摘下并等到polling清零, 之后队列和进程的页表才会被释放。
+
+#include "types.h"
+#include "paging.h"
+#include "memlayout.h"
+#include "proc.h"
+#include "timer.h"
+#include "uring.h"
+#include "wait.h"
+#include "global_func.h"
+
+#define URING_POLL_IDLE_US 2000 // 轮询线程空闲这么久之后睡眠
+#define URING_WRITE_CHUNK 128
+
+// 内核中的队列状态
+struct uring {
+  struct uring_sq *sq;    // 共享页的内核地址
+  struct uring_cq *cq;
+  struct proc *proc;      // 所属进程
+  uint32 sq_head;         // 提交队列的head, 内核私有, 只发布到共享页
+  uint32 cq_tail;         // 完成队列的tail, 同上
+  int flags;              // uring_setup的flags
+  int polled;             // 在poll_rings上
+  int polling;            // 轮询线程正在处理这个队列
+  int cq_wait;            // 所属进程在等待的完成数, 0表示没有等待
+  struct wait_queue cq_wq; // 等待完成的进程
+  struct list timeouts;   // 未完成的定时请求
+  struct list poll_link;  // 在轮询线程的链表上
+};
+
+// 未完成的URING_OP_TIMEOUT请求
+struct uring_timeout {
+  struct timer timer;
+  struct uring *ring;
+  uint64 user_data;
+  struct list link;
+};
+
+static struct list poll_rings;     // 开启SQPOLL的队列
+static int npoll;                  // poll_rings上的队列数
+static struct proc *poll_thread;   // 轮询线程, 空闲时在poll_rings通道上睡眠
+
+// 写入一个完成队列项, 必要时唤醒等待的进程。调用者需已关中断。
+// 共享页用户可写, 下标只用内核私有的tail和编译时的掩码计算,
+// 用户改写head最多让自己的完成项被覆盖, 不会越界。
+static void
+uring_post(struct uring *ring, uint64 user_data, int64 res)
+{
+  struct uring_cq *cq = ring->cq;
+  uint32 tail = ring->cq_tail;
+
+  if(tail - cq->head >= URING_CQ_ENTRIES){
+    cq->overflow++;
+    return;
+  }
+  cq->cqes[tail & (URING_CQ_ENTRIES - 1)].user_data = user_data;
+  cq->cqes[tail & (URING_CQ_ENTRIES - 1)].res = res;
+  __sync_synchronize(); // 先写内容, 再发布tail
+  ring->cq_tail = tail + 1;
+  cq->tail = tail + 1;
+
+  if(ring->cq_wait && ring->cq_tail - cq->head >= ring->cq_wait){
+    ring->cq_wait = 0;
+    wake_up(&ring->cq_wq, 1);
+  }
+}
+
+// 定时请求到期, 在TIMER_SOFTIRQ中执行
+static void
+uring_timeout_fire(void *arg)
+{
+  struct uring_timeout *to = arg;
+
+  lst_remove(&to->link);
+  uring_post(to->ring, to->user_data, 0);
+  kfree(to);
+}
+
+// 把buf开始的len字节写到控制台
+static int64
+uring_write(struct uring *ring, uint64 buf, uint64 len)
+{
+  char kbuf[URING_WRITE_CHUNK];
+  uint64 done = 0;
+
+  while(done < len){
+    uint64 m = len - done;
+    if(m > URING_WRITE_CHUNK)
+      m = URING_WRITE_CHUNK;
+    if(copyin(ring->proc->pagetable, kbuf, buf + done, m) < 0)
+      return done > 0 ? done : -1;
+    console_write(kbuf, m);
+    done += m;
+  }
+  return done;
+}
+
+// 执行一个请求。同步完成的操作直接写完成队列。
+static void
+uring_issue(struct uring *ring, struct uring_sqe *sqe)
+{
+  struct uring_timeout *to;
+  uint64 msg[IPC_MSG_WORDS];
+  int64 res;
+
+  switch(sqe->opcode){
+  case URING_OP_NOP:
+    res = 0;
+    break;
+  case URING_OP_WRITE:
+    res = uring_write(ring, sqe->addr, sqe->len);
+    break;
+  case URING_OP_TIMEOUT:
+    if((to = kmalloc(sizeof(*to))) == 0){
+      res = -1;
+      break;
+    }
+    to->ring = ring;
+    to->user_data = sqe->user_data;
+    timer_setup(&to->timer, uring_timeout_fire, to);
+    push_off();
+    lst_push(&ring->timeouts, &to->link);
+    timer_add(&to->timer, r_time() + US2CYCLES(sqe->arg));
+    pop_off();
+    return; // 到期时再完成
+  case URING_OP_MAP:
+    res = growproc(ring->proc, sqe->len);
+    break;
+  case URING_OP_SEND:
+    if(copyin(ring->proc->pagetable, (char *)msg, sqe->addr, sizeof(msg)) < 0)
+      res = -1;
+    else
+      res = ipc_send_nowait(ring->proc, sqe->fd, msg);
+    break;
+  default:
+    res = -1;
+    break;
+  }
+  push_off();
+  uring_post(ring, sqe->user_data, res);
+  pop_off();
+}
+
+// 处理提交队列中最多max个新请求, 返回处理的个数
+static int
+uring_submit(struct uring *ring, int max)
+{
+  struct uring_sq *sq = ring->sq;
+  struct uring_sqe sqe;
+  uint32 head = ring->sq_head;
+  uint32 tail = sq->tail;
+  int n = 0;
+
+  __sync_synchronize(); // 读到tail之后才能读请求内容
+  // tail由用户写, 不可信
+  if(tail - head > URING_SQ_ENTRIES)
+    tail = head + URING_SQ_ENTRIES;
+  while(head != tail && n < max){
+    // 先拷贝出来, 执行期间用户可能改写这一项
+    sqe = sq->sqes[head & (URING_SQ_ENTRIES - 1)];
+    head++;
+    ring->sq_head = head;
+    sq->head = head;
+    uring_issue(ring, &sqe);
+    n++;
+  }
+  return n;
+}
+
+// 轮询线程: 有SQPOLL队列时不断处理它们的提交队列,
+// 空闲URING_POLL_IDLE_US之后设置NEED_WAKEUP并睡眠。
+static void
+uring_poll_thread(void *arg)
+{
+  struct list *e;
+  struct uring *ring;
+  uint64 idle_since = r_time();
+  int busy;
+
+  for(;;){
+    busy = 0;
+    // 每次关中断取队首的队列并把它移到队尾, 开中断处理它的请求
+    for(int n = npoll; n > 0; n--){
+      push_off();
+      if(lst_empty(&poll_rings)){
+        pop_off();
+        break;
+      }
+      ring = lst_entry(poll_rings.next, struct uring, poll_link);
+      lst_remove(&ring->poll_link);
+      lst_push_back(&poll_rings, &ring->poll_link);
+      ring->polling = 1;
+      pop_off();
+
+      busy += uring_submit(ring, URING_SQ_ENTRIES);
+
+      push_off();
+      ring->polling = 0;
+      if(!ring->polled)
+        wakeup(ring);     // uring_exit在等待
+      pop_off();
+    }
+
+    push_off();
+    if(busy){
+      idle_since = r_time();
+    } else if(r_time() - idle_since >= US2CYCLES(URING_POLL_IDLE_US)){
+      for(e = poll_rings.next; e != &poll_rings; e = e->next)
+        lst_entry(e, struct uring, poll_link)->sq->flags |= URING_SQ_NEED_WAKEUP;
+      __sync_synchronize();
+      // 设置标志之后再检查一次, 避免错过用户刚提交的请求
+      busy = 0;
+      for(e = poll_rings.next; e != &poll_rings; e = e->next){
+        ring = lst_entry(e, struct uring, poll_link);
+        busy |= ring->sq->tail != ring->sq_head;
+      }
+      if(!busy)
+        sleep(&poll_rings);
+      for(e = poll_rings.next; e != &poll_rings; e = e->next)
+        lst_entry(e, struct uring, poll_link)->sq->flags &= ~URING_SQ_NEED_WAKEUP;
+      idle_since = r_time();
+    }
+    pop_off();
+    yield();
+  }
+}
+
+// uring_setup(flags): 为当前进程创建队列并映射到URING处
+int
+uring_setup(int flags)
+{
+  struct proc *p = myproc();
+  struct uring *ring;
+
+  if(p->uring)
+    return -1;
+  if((ring = kmalloc(sizeof(*ring))) == 0)
+    return -1;
+  memset(ring, 0, sizeof(*ring));
+  ring->sq = alloc_page();
+  ring->cq = alloc_page();
+  if(ring->sq == 0 || ring->cq == 0)
+    goto bad;
+
+  // 先保证轮询线程存在, 否则队列挂上poll_rings后不会有人处理
+  if(flags & URING_SETUP_SQPOLL){
+    push_off();
+    if(poll_thread == 0)
+      poll_thread = kthread_create(uring_poll_thread, 0, "uring_poll");
+    pop_off();
+    if(poll_thread == 0)
+      goto bad;
+  }
+  zero_page(ring->sq);
+  zero_page(ring->cq);
+  ring->sq->mask = URING_SQ_ENTRIES - 1;
+  ring->cq->mask = URING_CQ_ENTRIES - 1;
+  ring->proc = p;
+  ring->flags = flags;
+  lst_init(&ring->timeouts);
+  waitq_init(&ring->cq_wq);
+
+  if(mappages(p->pagetable, URING, PGSIZE, (uint64)ring->sq, PTE_R | PTE_W | PTE_U) < 0)
+    goto bad;
+  if(mappages(p->pagetable, URING + PGSIZE, PGSIZE, (uint64)ring->cq, PTE_R | PTE_W | PTE_U) < 0){
+    uvmunmap(p->pagetable, URING, 1, 0);
+    goto bad;
+  }
+
+  push_off();
+  p->uring = ring;
+  if(flags & URING_SETUP_SQPOLL){
+    lst_push_back(&poll_rings, &ring->poll_link);
+    ring->polled = 1;
+    npoll++;
+    wakeup(&poll_rings);
+  }
+  pop_off();
+  return 0;
+
+bad:
+  if(ring->sq)
+    free_page(ring->sq);
+  if(ring->cq)
+    free_page(ring->cq);
+  kfree(ring);
+  return -1;
+}
+
+// uring_enter(to_submit, min_complete, flags):
+// 处理最多to_submit个请求; 带URING_ENTER_GETEVENTS时等待
+// 完成队列中至少有min_complete个未消费的项。返回处理的请求数。
+int
+uring_enter(int to_submit, int min_complete, int flags)
+{
+  struct proc *p = myproc();
+  struct uring *ring = p->uring;
+  int n = 0;
+
+  if(ring == 0)
+    return -1;
+
+  if(ring->flags & URING_SETUP_SQPOLL){
+    if(flags & URING_ENTER_SQ_WAKEUP)
+      wakeup(&poll_rings);
+  } else if(to_submit > 0){
+    n = uring_submit(ring, to_submit);
+  }
+
+  if((flags & URING_ENTER_GETEVENTS) && min_complete > 0){
+    if(min_complete > URING_CQ_ENTRIES)
+      min_complete = URING_CQ_ENTRIES;
+    push_off();
+    while(ring->cq_tail - ring->cq->head < min_complete){
+      ring->cq_wait = min_complete;
+      waitq_sleep(&ring->cq_wq, 0);
+    }
+    ring->cq_wait = 0;
+    pop_off();
+  }
+  return n;
+}
+
+// 进程退出时调用, 在进程上下文中: 停止轮询p的队列,
+// 等轮询线程处理完手上的请求, 之后不会再有人访问p的用户内存。
+void
+uring_exit(struct proc *p)
+{
+  struct uring *ring = p->uring;
+
+  if(ring == 0)
+    return;
+  push_off();
+  if(ring->polled){
+    lst_remove(&ring->poll_link);
+    ring->polled = 0;
+    npoll--;
+  }
+  while(ring->polling)
+    sleep(ring);
+  pop_off();
+}
+
+// 进程释放时销毁它的队列
+void
+uring_free(struct proc *p)
+{
+  struct uring *ring = p->uring;
+  struct uring_timeout *to;
+
+  if(ring == 0)
+    return;
+  push_off();
+  while(!lst_empty(&ring->timeouts)){
+    to = lst_entry(lst_pop(&ring->timeouts), struct uring_timeout, link);
+    timer_cancel(&to->timer);
+    kfree(to);
+  }
+  if(ring->polled){
+    lst_remove(&ring->poll_link);
+    npoll--;
+  }
+  if(ring->polling)
+    panic("uring_free: polling");
+  p->uring = 0;
+  pop_off();
+
+  if(p->pagetable)
+    uvmunmap(p->pagetable, URING, 2, 0);
+  free_page(ring->sq);
+  free_page(ring->cq);
+  kfree(ring);
+}
+
+void
+uring_init(void)
+{
+  lst_init(&poll_rings);
+}
@@ -0,0 +1,69 @@
+#ifndef __URING_H
+#define __URING_H
+
+#include "types.h"
+
+// 异步批量系统调用的提交/完成队列, 与用户态共享 (uring.c)。
+//
+// uring_setup()把两页映射到用户地址空间: URING处是提交队列(SQ),
+// URING+PGSIZE处是完成队列(CQ)。用户填好sqes[tail & mask]后增加
+// sq.tail, 再用一次uring_enter()提交一批; 开启SQPOLL时内核轮询线程
+// 会自己取走请求, 只有sq.flags带URING_SQ_NEED_WAKEUP时才需要ecall。
+// 内核把结果写到cqes[tail & mask]并增加cq.tail, 用户消费后增加cq.head。
+// mask和内核写的head/tail只是给用户看的, 内核自己保存一份, 从不读回。
+
+#define URING_SQ_ENTRIES 64
+#define URING_CQ_ENTRIES 128
+
+// 操作码
+#define URING_OP_NOP     0 // 空操作, 立即完成
+#define URING_OP_WRITE   1 // 写控制台: addr=缓冲区, len=长度
+#define URING_OP_TIMEOUT 2 // 定时: arg=微秒, 到期后完成
+#define URING_OP_MAP     3 // 扩展进程内存: len=字节数, 结果为新内存的起始地址
+#define URING_OP_SEND    4 // 非阻塞IPC发送: fd=目标PID, addr=IPC_MSG_WORDS个字的消息
+
+// uring_setup的flags
+#define URING_SETUP_SQPOLL (1 << 0) // 由内核线程轮询提交队列
+
+// uring_enter的flags
+#define URING_ENTER_GETEVENTS (1 << 0) // 等待min_complete个完成
+#define URING_ENTER_SQ_WAKEUP (1 << 1) // 唤醒睡眠的轮询线程
+
+// sq.flags
+#define URING_SQ_NEED_WAKEUP (1 << 0) // 轮询线程已睡眠, 需要uring_enter唤醒
+
+// 提交队列项
+struct uring_sqe {
+  uint8 opcode;
+  uint8 flags;
+  uint16 pad;
+  int32 fd;
+  uint64 addr;
+  uint64 len;
+  uint64 arg;
+  uint64 user_data;       // 原样带回完成队列项
+};
+
+// 完成队列项
+struct uring_cqe {
+  uint64 user_data;
+  int64 res;              // 操作结果, 负数表示失败
+};
+
+struct uring_sq {
+  volatile uint32 head;   // 内核写
+  volatile uint32 tail;   // 用户写
+  uint32 mask;
+  volatile uint32 flags;
+  struct uring_sqe sqes[URING_SQ_ENTRIES];
+};
+
+struct uring_cq {
+  volatile uint32 head;   // 用户写
+  volatile uint32 tail;   // 内核写
+  uint32 mask;
+  volatile uint32 overflow; // 因为完成队列满而丢弃的完成数
+  struct uring_cqe cqes[URING_CQ_ENTRIES];
+};
+
+#endif // __URING_H
@@ -0,0 +1,59 @@
+// 共享时间页 (vdso.c)
+//
+// 内核分配一页struct vdso_data, 只读映射到每个进程的VDSO地址,
+// 用户态的gettime直接读time CSR计算, 不需要系统调用。
+
+#include "types.h"
+#include "paging.h"
+#include "memlayout.h"
+#include "timer.h"
+#include "vdso.h"
+#include "global_func.h"
+
+#define SCOUNTEREN_TM (1L << 1) // 允许用户态读time CSR
+
+static struct vdso_data *vdso_page;
+
+// 分配并初始化时间页, 需要在创建用户进程之前调用
+void
+vdso_init(void)
+{
+  if((vdso_page = alloc_page()) == 0)
+    panic("vdso_init");
+  zero_page(vdso_page);
+  vdso_page->freq = TIMER_FREQ;
+  vdso_page->boot_time = r_time();
+  vdso_page->wall_offset = 0; // 没有RTC, 由settime设置
+
+  // 用户态的rdtime需要scounteren.TM
+  w_scounteren(r_scounteren() | SCOUNTEREN_TM);
+}
+
+// 把时间页只读映射到用户页表的VDSO地址
+int
+vdso_map(pagetable_t pagetable)
+{
+  return mappages(pagetable, VDSO, PGSIZE, (uint64)vdso_page, PTE_R | PTE_U);
+}
+
+// 设置当前墙上时间 (纳秒), 按顺序锁协议更新
+void
+vdso_settime(uint64 ns)
+{
+  struct vdso_data *vd = vdso_page;
+
+  push_off();
+  vd->seq++;
+  __sync_synchronize();
+  vd->wall_offset = ns - vdso_cycles2ns(r_time() - vd->boot_time, vd->freq);
+  __sync_synchronize();
+  vd->seq++;
+  pop_off();
+}
+
+// 内核读取墙上时间 (纳秒), 与用户态读法相同
+uint64
+vdso_gettime_kernel(void)
+{
+  return vdso_gettime(vdso_page);
+}
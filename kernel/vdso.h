@@ -0,0 +1,52 @@
+#ifndef __VDSO_H
+#define __VDSO_H
+
+#include "types.h"
+
+// 映射到每个进程地址空间VDSO处的只读时间页。
+// 用户态读time CSR并结合这里的参数即可得到当前时间, 不需要陷入内核。
+// 内核更新时用顺序锁: seq为奇数表示正在写, 读者读前后seq不变才有效。
+struct vdso_data {
+  volatile uint32 seq;         // 顺序锁
+  uint32 pad;
+  volatile uint64 freq;        // time CSR的频率 (Hz)
+  volatile uint64 boot_time;   // 启动时的time CSR值
+  volatile uint64 wall_offset; // 启动时刻对应的墙上时间 (纳秒)
+};
+
+static inline uint64
+vdso_rdtime(void)
+{
+  uint64 x;
+  asm volatile("rdtime %0" : "=r" (x));
+  return x;
+}
+
+// 启动以来经过的time计数转换为纳秒, 分两部分计算避免乘法溢出
+static inline uint64
+vdso_cycles2ns(uint64 cycles, uint64 freq)
+{
+  return (cycles / freq) * 1000000000UL + (cycles % freq) * 1000000000UL / freq;
+}
+
+// 读取墙上时间 (纳秒)。内核和用户态共用这段代码。
+static inline uint64
+vdso_gettime(struct vdso_data *vd)
+{
+  uint32 seq;
+  uint64 t, freq, boot, off;
+
+  do {
+    seq = vd->seq;
+    __sync_synchronize();
+    freq = vd->freq;
+    boot = vd->boot_time;
+    off = vd->wall_offset;
+    t = vdso_rdtime();
+    __sync_synchronize();
+  } while((seq & 1) || seq != vd->seq);
+
+  return off + vdso_cycles2ns(t - boot, freq);
+}
+
+#endif // __VDSO_H
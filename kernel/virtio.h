@@ -0,0 +1,93 @@
+#ifndef __VIRTIO_H
+#define __VIRTIO_H
+
+#include "types.h"
+
+// virtio-mmio设备的寄存器和split virtqueue的结构 (virtio_blk.c)。
+// 参见virtio规范1.1的4.2节(MMIO传输)和2.6节(split virtqueue)。
+// 只支持非legacy(version 2)的接口, QEMU需要
+// -global virtio-mmio.force-legacy=false。
+
+// MMIO寄存器, 相对于设备基地址的偏移
+#define VIRTIO_MMIO_MAGIC_VALUE       0x000 // 0x74726976 ("virt")
+#define VIRTIO_MMIO_VERSION           0x004 // 2
+#define VIRTIO_MMIO_DEVICE_ID         0x008 // 1为网卡, 2为块设备
+#define VIRTIO_MMIO_VENDOR_ID         0x00c // 0x554d4551
+#define VIRTIO_MMIO_DEVICE_FEATURES   0x010
+#define VIRTIO_MMIO_DRIVER_FEATURES   0x020
+#define VIRTIO_MMIO_QUEUE_SEL         0x030 // 选择队列, 只写
+#define VIRTIO_MMIO_QUEUE_NUM_MAX     0x034 // 当前队列的最大长度, 只读
+#define VIRTIO_MMIO_QUEUE_NUM         0x038 // 当前队列的长度, 只写
+#define VIRTIO_MMIO_QUEUE_READY       0x044 // 队列就绪位
+#define VIRTIO_MMIO_QUEUE_NOTIFY      0x050 // 通知设备有新请求, 只写
+#define VIRTIO_MMIO_INTERRUPT_STATUS  0x060 // 只读
+#define VIRTIO_MMIO_INTERRUPT_ACK     0x064 // 只写
+#define VIRTIO_MMIO_STATUS            0x070 // 读写
+#define VIRTIO_MMIO_QUEUE_DESC_LOW    0x080 // 描述符表的物理地址, 只写
+#define VIRTIO_MMIO_QUEUE_DESC_HIGH   0x084
+#define VIRTIO_MMIO_DRIVER_DESC_LOW   0x090 // avail环的物理地址, 只写
+#define VIRTIO_MMIO_DRIVER_DESC_HIGH  0x094
+#define VIRTIO_MMIO_DEVICE_DESC_LOW   0x0a0 // used环的物理地址, 只写
+#define VIRTIO_MMIO_DEVICE_DESC_HIGH  0x0a4
+#define VIRTIO_MMIO_CONFIG            0x100 // 设备相关的配置空间
+
+// 状态寄存器的位
+#define VIRTIO_CONFIG_S_ACKNOWLEDGE 1
+#define VIRTIO_CONFIG_S_DRIVER      2
+#define VIRTIO_CONFIG_S_DRIVER_OK   4
+#define VIRTIO_CONFIG_S_FEATURES_OK 8
+
+// 中断状态寄存器的位
+#define VIRTIO_INT_USED_RING 1 // used环有更新
+#define VIRTIO_INT_CONFIG    2 // 配置空间有变化
+
+// 特性位
+#define VIRTIO_BLK_F_RO              5  // 只读磁盘
+#define VIRTIO_BLK_F_SCSI            7  // 支持scsi命令直通
+#define VIRTIO_BLK_F_CONFIG_WCE      11 // 可以配置写缓存
+#define VIRTIO_BLK_F_MQ              12 // 支持多个队列
+#define VIRTIO_F_ANY_LAYOUT          27
+#define VIRTIO_RING_F_INDIRECT_DESC  28
+#define VIRTIO_RING_F_EVENT_IDX      29
+
+// 描述符表
+struct virtq_desc {
+  uint64 addr;
+  uint32 len;
+  uint16 flags;
+  uint16 next;
+};
+#define VRING_DESC_F_NEXT  1 // 与next指向的描述符串成一个请求
+#define VRING_DESC_F_WRITE 2 // 设备写入(相对于读取)
+
+// avail环: 驱动把请求的第一个描述符的编号放进来
+struct virtq_avail {
+  uint16 flags;
+  uint16 idx;       // 驱动下一个要写的位置 (不取模)
+  uint16 ring[];    // 长度为队列长度
+};
+
+// used环中的一项: 设备处理完的请求
+struct virtq_used_elem {
+  uint32 id;        // 请求的第一个描述符的编号
+  uint32 len;
+};
+
+struct virtq_used {
+  uint16 flags;     // VIRTQ_USED_F_NO_NOTIFY: 设备正在处理, 不需要通知
+  uint16 idx;       // 设备下一个要写的位置 (不取模)
+  struct virtq_used_elem ring[];
+};
+#define VIRTQ_USED_F_NO_NOTIFY 1
+
+// 块设备请求的头部, 在第一个描述符中
+#define VIRTIO_BLK_T_IN  0 // 读
+#define VIRTIO_BLK_T_OUT 1 // 写
+
+struct virtio_blk_outhdr {
+  uint32 type;
+  uint32 reserved;
+  uint64 sector;
+};
+
+#endif // __VIRTIO_H
@@ -0,0 +1,349 @@
+// virtio-mmio块设备驱动 (virtio_blk.c)
+//
+// 使用一个split virtqueue。每个请求是一条描述符链:
+// 头部(virtio_blk_outhdr) + 最多BLK_MAX_SEGS个数据段 + 1字节的状态,
+// 可以同时有多个请求在设备上。
+//
+// virtio_blk_submit一次提交一批请求: 描述符不够的请求在pending队列中排队,
+// 能放下的全部写进avail环后只更新一次avail->idx、只通知一次设备;
+// 设备在used环的flags中表示正在处理时连这一次通知也省掉。
+//
+// 完成通过PLIC中断通知: 上半部只应答中断并调度tasklet,
+// tasklet收集used环中完成的请求, 释放描述符, 用空出的描述符提交
+// pending中的请求(同样只通知一次), 最后在锁外调用各请求的end_io。
+
+#include "types.h"
+#include "paging.h"
+#include "memlayout.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "softirq.h"
+#include "virtio.h"
+#include "blk.h"
+#include "global_func.h"
+
+#define NUM 64 // 队列长度, 即描述符的个数
+
+#define R(r) ((volatile uint32 *)(VIRTIO0 + (r)))
+
+static struct {
+  struct spinlock lock;
+  struct virtq_desc *desc;
+  struct virtq_avail *avail;
+  struct virtq_used *used;
+
+  uint16 free_head;                       // 空闲描述符通过next串成链表
+  int nfree;
+  uint16 used_idx;                        // 下一个要处理的used环位置
+
+  // 以请求的第一个描述符的编号为下标
+  struct blk_req *req[NUM];
+  struct virtio_blk_outhdr hdr[NUM];
+  uint8 status[NUM];                      // 设备写入的完成状态, 0为成功
+
+  struct list pending;                    // 等待描述符的请求
+  struct tasklet done_tasklet;
+
+  int present;
+  uint64 capacity;                        // 扇区数
+
+  // 统计
+  uint64 nreq;
+  uint64 nkick;                           // 通知设备的次数
+  uint64 nirq;
+  int inflight;
+  int max_inflight;
+} vblk;
+
+static uint16
+desc_alloc(void)
+{
+  uint16 i = vblk.free_head;
+
+  vblk.free_head = vblk.desc[i].next;
+  vblk.nfree--;
+  return i;
+}
+
+// 释放从i开始的整条描述符链
+static void
+desc_free_chain(uint16 i)
+{
+  for(;;){
+    uint16 flags = vblk.desc[i].flags;
+    uint16 next = vblk.desc[i].next;
+
+    vblk.desc[i].addr = 0;
+    vblk.desc[i].len = 0;
+    vblk.desc[i].flags = 0;
+    vblk.desc[i].next = vblk.free_head;
+    vblk.free_head = i;
+    vblk.nfree++;
+    if((flags & VRING_DESC_F_NEXT) == 0)
+      break;
+    i = next;
+  }
+}
+
+// 为请求r建立描述符链并放入avail环的第slot项(还没有发布)。
+// 描述符不够时返回-1。调用者持有vblk.lock。
+static int
+vblk_queue(struct blk_req *r, uint16 slot)
+{
+  uint16 head, prev, d;
+
+  if(vblk.nfree < r->nseg + 2)
+    return -1;
+
+  head = desc_alloc();
+  vblk.hdr[head].type = r->write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+  vblk.hdr[head].reserved = 0;
+  vblk.hdr[head].sector = r->sector;
+  vblk.desc[head].addr = (uint64)&vblk.hdr[head];
+  vblk.desc[head].len = sizeof(vblk.hdr[head]);
+  vblk.desc[head].flags = VRING_DESC_F_NEXT;
+
+  prev = head;
+  for(int i = 0; i < r->nseg; i++){
+    d = desc_alloc();
+    vblk.desc[prev].next = d;
+    vblk.desc[d].addr = (uint64)r->seg[i].addr;
+    vblk.desc[d].len = r->seg[i].len;
+    // 读请求时设备写内存
+    vblk.desc[d].flags = VRING_DESC_F_NEXT | (r->write ? 0 : VRING_DESC_F_WRITE);
+    prev = d;
+  }
+
+  d = desc_alloc();
+  vblk.desc[prev].next = d;
+  vblk.status[head] = 0xff; // 设备成功时写0
+  vblk.desc[d].addr = (uint64)&vblk.status[head];
+  vblk.desc[d].len = 1;
+  vblk.desc[d].flags = VRING_DESC_F_WRITE;
+  vblk.desc[d].next = 0;
+
+  vblk.req[head] = r;
+  vblk.avail->ring[slot % NUM] = head;
+  return 0;
+}
+
+// 把pending中能放下的请求全部交给设备, 最多通知一次。
+// 调用者持有vblk.lock。
+static void
+vblk_start(void)
+{
+  uint16 idx = vblk.avail->idx;
+  int added = 0;
+
+  while(!lst_empty(&vblk.pending)){
+    struct blk_req *r = lst_entry(vblk.pending.next, struct blk_req, link);
+    if(vblk_queue(r, idx + added) < 0)
+      break;
+    lst_remove(&r->link);
+    added++;
+  }
+  if(added == 0)
+    return;
+
+  vblk.inflight += added;
+  if(vblk.inflight > vblk.max_inflight)
+    vblk.max_inflight = vblk.inflight;
+
+  // 描述符和avail环的内容必须先于idx被设备看到
+  __sync_synchronize();
+  vblk.avail->idx = idx + added;
+  __sync_synchronize();
+  if((vblk.used->flags & VIRTQ_USED_F_NO_NOTIFY) == 0){
+    *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // 队列0
+    vblk.nkick++;
+  }
+}
+
+// 提交n个请求, 立即返回, 完成时调用各自的end_io
+void
+virtio_blk_submit(struct blk_req **reqs, int n)
+{
+  if(!vblk.present){
+    for(int i = 0; i < n; i++){
+      reqs[i]->status = -1;
+      reqs[i]->done = 1;
+      if(reqs[i]->end_io)
+        reqs[i]->end_io(reqs[i]);
+      else
+        wakeup(reqs[i]);
+    }
+    return;
+  }
+
+  acquire(&vblk.lock);
+  for(int i = 0; i < n; i++){
+    if(reqs[i]->nseg <= 0 || reqs[i]->nseg > BLK_MAX_SEGS)
+      panic("virtio_blk_submit");
+    reqs[i]->done = 0;
+    lst_push_back(&vblk.pending, &reqs[i]->link);
+  }
+  vblk.nreq += n;
+  vblk_start();
+  release(&vblk.lock);
+}
+
+// 同步读写: 提交请求r并睡眠到完成, 返回r->status。只能在进程上下文中调用。
+int
+virtio_blk_rw(struct blk_req *r)
+{
+  r->end_io = 0;
+  virtio_blk_submit(&r, 1);
+  // 关中断检查再睡眠, 不会错过完成时的唤醒
+  push_off();
+  while(!r->done)
+    sleep(r);
+  pop_off();
+  return r->status;
+}
+
+// 完成处理, 在TASKLET_SOFTIRQ中执行
+static void
+vblk_done(struct tasklet *t)
+{
+  struct list done;
+
+  lst_init(&done);
+  acquire(&vblk.lock);
+  while(vblk.used_idx != vblk.used->idx){
+    __sync_synchronize();
+    uint16 id = vblk.used->ring[vblk.used_idx % NUM].id;
+    struct blk_req *r = vblk.req[id];
+
+    if(r == 0)
+      panic("vblk_done");
+    r->status = vblk.status[id] == 0 ? 0 : -1;
+    vblk.req[id] = 0;
+    desc_free_chain(id);
+    vblk.inflight--;
+    lst_push_back(&done, &r->link);
+    vblk.used_idx++;
+  }
+  // 用释放的描述符提交排队的请求
+  vblk_start();
+  release(&vblk.lock);
+
+  while(!lst_empty(&done)){
+    struct blk_req *r = lst_entry(lst_pop(&done), struct blk_req, link);
+    r->done = 1;
+    if(r->end_io)
+      r->end_io(r);
+    else
+      wakeup(r);
+  }
+}
+
+// 中断上半部: 应答中断, 完成处理交给tasklet
+static void
+virtio_blk_intr(void)
+{
+  *R(VIRTIO_MMIO_INTERRUPT_ACK) = *R(VIRTIO_MMIO_INTERRUPT_STATUS) & 0x3;
+  vblk.nirq++;
+  tasklet_schedule(&vblk.done_tasklet);
+}
+
+// 磁盘的扇区数, 没有磁盘时为0
+uint64
+virtio_blk_capacity(void)
+{
+  return vblk.capacity;
+}
+
+// 打印统计, 调试用
+void
+virtio_blk_stat_print(void)
+{
+  if(!vblk.present)
+    return;
+  printf("virtio-blk: %lu reqs, %lu kicks, %lu irqs, max %d in flight\n",
+         vblk.nreq, vblk.nkick, vblk.nirq, vblk.max_inflight);
+}
+
+// 初始化设备, 按virtio规范3.1.1节的顺序。没有磁盘时只打印一条信息。
+// 需要在kvm_init映射VIRTIO0之后、plic_inithart之前调用。
+void
+virtio_blk_init(void)
+{
+  uint32 status = 0;
+  uint32 features;
+  void *pages[3];
+
+  initlock(&vblk.lock, "virtio_blk");
+  lst_init(&vblk.pending);
+  tasklet_init(&vblk.done_tasklet, vblk_done);
+
+  if(*R(VIRTIO_MMIO_MAGIC_VALUE) != 0x74726976 ||
+     *R(VIRTIO_MMIO_VERSION) != 2 ||
+     *R(VIRTIO_MMIO_DEVICE_ID) != 2 ||
+     *R(VIRTIO_MMIO_VENDOR_ID) != 0x554d4551){
+    printf("virtio-blk: no disk\n");
+    return;
+  }
+
+  // 复位设备
+  *R(VIRTIO_MMIO_STATUS) = status;
+
+  status |= VIRTIO_CONFIG_S_ACKNOWLEDGE;
+  *R(VIRTIO_MMIO_STATUS) = status;
+  status |= VIRTIO_CONFIG_S_DRIVER;
+  *R(VIRTIO_MMIO_STATUS) = status;
+
+  // 协商特性
+  features = *R(VIRTIO_MMIO_DEVICE_FEATURES);
+  features &= ~(1 << VIRTIO_BLK_F_RO);
+  features &= ~(1 << VIRTIO_BLK_F_SCSI);
+  features &= ~(1 << VIRTIO_BLK_F_CONFIG_WCE);
+  features &= ~(1 << VIRTIO_BLK_F_MQ);
+  features &= ~(1 << VIRTIO_F_ANY_LAYOUT);
+  features &= ~(1 << VIRTIO_RING_F_EVENT_IDX);
+  features &= ~(1 << VIRTIO_RING_F_INDIRECT_DESC);
+  *R(VIRTIO_MMIO_DRIVER_FEATURES) = features;
+
+  status |= VIRTIO_CONFIG_S_FEATURES_OK;
+  *R(VIRTIO_MMIO_STATUS) = status;
+  if(!(*R(VIRTIO_MMIO_STATUS) & VIRTIO_CONFIG_S_FEATURES_OK))
+    panic("virtio-blk: FEATURES_OK unset");
+
+  // 初始化队列0
+  *R(VIRTIO_MMIO_QUEUE_SEL) = 0;
+  if(*R(VIRTIO_MMIO_QUEUE_READY))
+    panic("virtio-blk: queue in use");
+  if(*R(VIRTIO_MMIO_QUEUE_NUM_MAX) < NUM)
+    panic("virtio-blk: queue too short");
+  for(int i = 0; i < 3; i++){
+    if((pages[i] = alloc_page()) == 0)
+      panic("virtio-blk: alloc_page");
+    zero_page(pages[i]);
+  }
+  vblk.desc = pages[0];
+  vblk.avail = pages[1];
+  vblk.used = pages[2];
+  *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
+  *R(VIRTIO_MMIO_QUEUE_DESC_LOW) = (uint64)vblk.desc;
+  *R(VIRTIO_MMIO_QUEUE_DESC_HIGH) = (uint64)vblk.desc >> 32;
+  *R(VIRTIO_MMIO_DRIVER_DESC_LOW) = (uint64)vblk.avail;
+  *R(VIRTIO_MMIO_DRIVER_DESC_HIGH) = (uint64)vblk.avail >> 32;
+  *R(VIRTIO_MMIO_DEVICE_DESC_LOW) = (uint64)vblk.used;
+  *R(VIRTIO_MMIO_DEVICE_DESC_HIGH) = (uint64)vblk.used >> 32;
+  *R(VIRTIO_MMIO_QUEUE_READY) = 1;
+
+  for(int i = NUM - 1; i >= 0; i--){
+    vblk.desc[i].next = vblk.free_head;
+    vblk.free_head = i;
+  }
+  vblk.nfree = NUM;
+
+  status |= VIRTIO_CONFIG_S_DRIVER_OK;
+  *R(VIRTIO_MMIO_STATUS) = status;
+
+  // 配置空间的第一个字段是64位的容量(扇区数)
+  vblk.capacity = *R(VIRTIO_MMIO_CONFIG) | (uint64)*R(VIRTIO_MMIO_CONFIG + 4) << 32;
+  vblk.present = 1;
+
+  plic_register(VIRTIO0_IRQ, 1, virtio_blk_intr);
+  printf("virtio-blk: %lu sectors\n", vblk.capacity);
+}
@@ -12,6 +12,7 @@ void free_page(void*);
 void* memset(void*, int, uint);
 void* memmove(void*, const void*, uint);
 extern char etext[]; // 内核代码段结束地址
+extern char trampoline[]; // trampoline.S
 extern char end[];   // 供范围检查时可选使用
 
 // 全局唯一的内核页表
@@ -22,7 +23,7 @@ pagetable_t kernel_pagetable;
 static pte_t*
 walk(pagetable_t pagetable, uint64 va, int alloc)
 {
-  if(va >= PHYSTOP)
+  if(va >= MAXVA)
     panic("walk");
 
   for(int level = PT_LEVELS-1; level > 0; level--) {
@@ -32,7 +33,7 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
     } else {//无效
       if(!alloc || (pagetable = (pagetable_t)alloc_page()) == 0) //不分配或者分配失败的情形
         return 0;
-      memset(pagetable, 0, PGSIZE);//否则分配成功，清零
+      zero_page(pagetable);//否则分配成功，清零
       *pte = PA2PTE(pagetable) | PTE_V;//写入pte，但是不会写入最后一级的pte
     }
   }
@@ -48,6 +49,7 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 
   if(size == 0)
     panic("mappages: size");
+  TRACE(TRACE_MAPPAGES, va, size, pa);
 
   a = PGROUNDDOWN(va);
   last = PGROUNDDOWN(va + size - 1);
@@ -70,16 +72,25 @@ void
 kvm_init()
 {
   kernel_pagetable = (pagetable_t) alloc_page();
-  memset(kernel_pagetable, 0, PGSIZE);
+  zero_page(kernel_pagetable);
 
   // 映射UART设备
   mappages(kernel_pagetable, UART0, PGSIZE, UART0, PTE_R | PTE_W);
 
+  // 映射virtio磁盘
+  mappages(kernel_pagetable, VIRTIO0, PGSIZE, VIRTIO0, PTE_R | PTE_W);
+
+  // 映射PLIC
+  mappages(kernel_pagetable, PLIC, PLIC_SIZE, PLIC, PTE_R | PTE_W);
+
   // 映射内核代码段 (R+X)
   mappages(kernel_pagetable, KERNBASE, (uint64)etext-KERNBASE, KERNBASE, PTE_R | PTE_X);
 
   // 映射内核数据段和剩余物理内存 (R+W)
   mappages(kernel_pagetable, (uint64)etext, PHYSTOP-(uint64)etext, (uint64)etext, PTE_R | PTE_W);
+
+  // 将trampoline映射到内核地址空间的最高处, 与用户页表中的地址一致
+  mappages(kernel_pagetable, TRAMPOLINE, PGSIZE, (uint64)trampoline, PTE_R | PTE_X);
 }
 
 // 启用分页 (加载内核页表到SATP寄存器)
@@ -151,7 +162,7 @@ void destroy_pagetable(pagetable_t pt) {
 }
 
 // 为一个进程创建一个用户页表
-// (不包含任何映射)
+// 只包含trampoline和trapframe的映射, 它们没有PTE_U, 用户态不能访问
 pagetable_t
 proc_pagetable(struct proc *p)
 {
@@ -161,10 +172,145 @@ proc_pagetable(struct proc *p)
   pagetable = (pagetable_t) alloc_page();
   if(pagetable == 0)
     return 0;
-  memset(pagetable, 0, PGSIZE);
+  zero_page(pagetable);
+
+  // 陷入与返回的代码, 用户页表和内核页表中地址相同
+  if(mappages(pagetable, TRAMPOLINE, PGSIZE, (uint64)trampoline, PTE_R | PTE_X) < 0){
+    destroy_pagetable(pagetable);
+    return 0;
+  }
+
+  // uservec把用户寄存器保存在这里
+  if(mappages(pagetable, TRAPFRAME, PGSIZE, (uint64)p->trapframe, PTE_R | PTE_W) < 0){
+    destroy_pagetable(pagetable);
+    return 0;
+  }
+
+  // 共享时间页, 用户态只读
+  if(vdso_map(pagetable) < 0){
+    destroy_pagetable(pagetable);
+    return 0;
+  }
   return pagetable;
 }
 
+// 查找用户虚拟地址va所在页的物理地址。
+// 未映射或者用户态不可访问时返回0。
+uint64
+walkaddr(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+
+  if(va >= MAXVA)
+    return 0;
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0)
+    return 0;
+  return PTE2PA(*pte);
+}
+
+// 从用户地址srcva拷贝len字节到内核地址dst, 成功返回0, 失败返回-1
+int
+copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
+{
+  uint64 n, va0, pa0;
+
+  while(len > 0){
+    va0 = PGROUNDDOWN(srcva);
+    if((pa0 = walkaddr(pagetable, va0)) == 0)
+      return -1;
+    n = PGSIZE - (srcva - va0);
+    if(n > len)
+      n = len;
+    memmove(dst, (void *)(pa0 + (srcva - va0)), n);
+    len -= n;
+    dst += n;
+    srcva = va0 + PGSIZE;
+  }
+  return 0;
+}
+
+// 从内核地址src拷贝len字节到用户地址dstva, 成功返回0, 失败返回-1
+int
+copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
+{
+  uint64 n, va0, pa0;
+  pte_t *pte;
+
+  while(len > 0){
+    va0 = PGROUNDDOWN(dstva);
+    if((pa0 = walkaddr(pagetable, va0)) == 0)
+      return -1;
+    pte = walk(pagetable, va0, 0);
+    if((*pte & PTE_W) == 0)
+      return -1;
+    n = PGSIZE - (dstva - va0);
+    if(n > len)
+      n = len;
+    memmove((void *)(pa0 + (dstva - va0)), src, n);
+    len -= n;
+    src += n;
+    dstva = va0 + PGSIZE;
+  }
+  return 0;
+}
+
+// 取消[va, va+npages*PGSIZE)的映射, 这些页必须都已映射。
+// do_free为1时同时释放物理页。
+void
+uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
+{
+  pte_t *pte;
+
+  if(va % PGSIZE)
+    panic("uvmunmap: not aligned");
+  for(uint64 a = va; a < va + npages * PGSIZE; a += PGSIZE){
+    if((pte = walk(pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0)
+      panic("uvmunmap: not mapped");
+    if(do_free)
+      free_page((void*)PTE2PA(*pte));
+    *pte = 0;
+  }
+}
+
+// 释放进程的用户内存[0, sz)和页表本身。
+// trampoline和trapframe不属于这个页表, 只取消映射。
+void
+proc_freepagetable(pagetable_t pagetable, uint64 sz)
+{
+  if(sz > 0)
+    uvmunmap(pagetable, 0, PGROUNDUP(sz) / PGSIZE, 1);
+  destroy_pagetable(pagetable);
+}
+
+// 为用户地址空间分配[oldsz, newsz)的内存并清零, 成功返回newsz, 失败返回0
+uint64
+uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
+{
+  char *mem;
+  uint64 a;
+
+  if(newsz < oldsz)
+    return oldsz;
+  for(a = PGROUNDUP(oldsz); a < newsz; a += PGSIZE){
+    mem = alloc_page();
+    if(mem == 0)
+      goto err;
+    zero_page(mem);
+    if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R | PTE_W | PTE_U) != 0){
+      free_page(mem);
+      goto err;
+    }
+  }
+  return newsz;
+
+err:
+  // 撤销已经映射的部分
+  if(a > PGROUNDUP(oldsz))
+    uvmunmap(pagetable, PGROUNDUP(oldsz), (a - PGROUNDUP(oldsz)) / PGSIZE, 1);
+  return 0;
+}
+
 // 将初始用户程序(initcode)加载到用户页表的虚拟地址0
 void
 uvminit(pagetable_t pagetable, uchar *src, uint sz)
@@ -176,11 +322,11 @@ uvminit(pagetable_t pagetable, uchar *src, uint sz)
   // 分配一页物理内存
   mem = alloc_page();
   // 将该页清零
-  memset(mem, 0, PGSIZE);
+  zero_page(mem);
   // 将虚拟地址0映射到刚分配的物理页
   // PTE_U: 用户态可以访问
   // PTE_R|W|X: 可读、可写、可执行
   mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W|PTE_R|PTE_X|PTE_U);
   // 将initcode的内容拷贝到该物理页
-  memmove(mem, src, sz);
+  memcpy(mem, src, sz);
 }
@@ -0,0 +1,127 @@
+// 睡眠与唤醒 (wait.c)
+//
+// 每个事件有自己的等待队列, 唤醒只访问这个队列上的进程,
+// 代价与系统中的进程总数无关。
+// 没有自己等待队列的代码可以用sleep(chan)/wakeup(chan):
+// 通道按地址散列到一组共享的等待队列上, wakeup只扫描一个桶。
+//
+// 调用者先push_off, 检查条件, 条件不满足时调用waitq_sleep,
+// 醒来后重新检查。单核上关中断就保证了检查条件和挂入队列之间
+// 不会丢失唤醒; 唤醒可以在中断中进行。
+
+#include "types.h"
+#include "proc.h"
+#include "wait.h"
+#include "global_func.h"
+
+#define CHAN_HASH_BITS 6
+#define CHAN_HASH_SIZE (1 << CHAN_HASH_BITS)
+
+static struct wait_queue chan_table[CHAN_HASH_SIZE];
+
+static struct wait_queue *
+chan_queue(void *chan)
+{
+  return &chan_table[((uint64)chan * 0x9E3779B97F4A7C15UL) >> (64 - CHAN_HASH_BITS)];
+}
+
+// 把当前进程挂到wq上并睡眠, 被唤醒后返回。调用者必须已push_off且只有一层。
+static void
+waitq_sleep_chan(struct wait_queue *wq, void *chan, int exclusive)
+{
+  struct proc *p = myproc();
+  struct wait_entry we;
+
+  we.proc = p;
+  we.chan = chan;
+  we.exclusive = exclusive;
+  if(exclusive)
+    lst_push_back(&wq->head, &we.link);
+  else
+    lst_push(&wq->head, &we.link);
+
+  p->state = SLEEPING;
+  sched();
+
+  // 被wakeup_proc等其他途径唤醒时还在队列上
+  if(we.link.next != &we.link)
+    lst_remove(&we.link);
+}
+
+// 唤醒wq上通道为chan的等待者(chan为0时不区分通道):
+// 全部非排他的, 以及最多nr个排他的。返回唤醒的进程数。
+static int
+wake_up_chan(struct wait_queue *wq, void *chan, int nr)
+{
+  struct list *e, *next;
+  struct wait_entry *we;
+  int woken = 0;
+
+  push_off();
+  for(e = wq->head.next; e != &wq->head; e = next){
+    next = e->next;
+    we = lst_entry(e, struct wait_entry, link);
+    if(chan && we->chan != chan)
+      continue;
+    if(we->exclusive && nr <= 0)
+      break;
+    // 从队列上摘下并指向自己, 睡眠者据此知道已经被摘下
+    lst_remove(&we->link);
+    we->link.next = we->link.prev = &we->link;
+    wakeup_proc(we->proc);
+    woken++;
+    if(we->exclusive)
+      nr--;
+  }
+  pop_off();
+  return woken;
+}
+
+// 在wq上睡眠, exclusive为1时是排他等待
+void
+waitq_sleep(struct wait_queue *wq, int exclusive)
+{
+  waitq_sleep_chan(wq, 0, exclusive);
+}
+
+// 唤醒wq上的所有非排他等待者和最多nr个排他等待者
+int
+wake_up(struct wait_queue *wq, int nr)
+{
+  return wake_up_chan(wq, 0, nr);
+}
+
+// 在通道chan上睡眠。调用者必须已push_off且只有一层。
+void
+sleep(void *chan)
+{
+  waitq_sleep_chan(chan_queue(chan), chan, 0);
+}
+
+// 在通道chan上排他地睡眠, wakeup_one一次只唤醒其中一个
+void
+sleep_exclusive(void *chan)
+{
+  waitq_sleep_chan(chan_queue(chan), chan, 1);
+}
+
+// 唤醒在chan上睡眠的所有进程
+int
+wakeup(void *chan)
+{
+  return wake_up_chan(chan_queue(chan), chan, 1 << 30);
+}
+
+// 唤醒chan上所有非排他的等待者和一个排他的等待者
+int
+wakeup_one(void *chan)
+{
+  return wake_up_chan(chan_queue(chan), chan, 1);
+}
+
+void
+wait_init(void)
+{
+  for(int i = 0; i < CHAN_HASH_SIZE; i++)
+    waitq_init(&chan_table[i]);
+}
@@ -0,0 +1,34 @@
+#ifndef __WAIT_H
+#define __WAIT_H
+
+#include "types.h"
+#include "list.h"
+
+// 等待队列: 等待某个事件的进程挂在上面, 事件发生时只唤醒这些进程。
+// 非排他的等待者在队头, 排他的在队尾; wake_up唤醒所有非排他的
+// 等待者和最多nr个排他的等待者, 避免惊群。
+struct wait_queue {
+  struct list head;
+};
+
+// 一个等待者, 在睡眠进程的栈上
+struct wait_entry {
+  struct list link;
+  struct proc *proc;
+  void *chan;      // sleep(chan)的通道, 直接使用等待队列时为0
+  int exclusive;   // 排他等待, 一次唤醒只唤醒一个
+};
+
+static inline void
+waitq_init(struct wait_queue *wq)
+{
+  lst_init(&wq->head);
+}
+
+static inline int
+waitq_active(struct wait_queue *wq)
+{
+  return !lst_empty(&wq->head);
+}
+
+#endif // __WAIT_H
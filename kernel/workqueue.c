@@ -0,0 +1,121 @@
+// 工作队列 (workqueue.c)
+//
+// 中断处理和系统调用路径上不适合做的耗时工作(清零页面、刷新日志、
+// 回收内存等)可以打包成struct work, 交给一组worker内核线程执行。
+// 没有work时worker在wq->idle上排他地睡眠, queue_work只唤醒其中一个。
+
+#include "types.h"
+#include "proc.h"
+#include "global_func.h"
+
+#define SYSTEM_WQ_WORKERS 2 // 系统默认工作队列的worker数
+
+// 每个worker线程一个
+struct worker {
+  struct proc *proc;
+  struct workqueue *wq;
+};
+
+static struct workqueue *system_wq;
+
+// worker线程的主循环: 取出work执行, 没有work时睡眠
+static void
+worker_thread(void *arg)
+{
+  struct worker *wk = arg;
+  struct workqueue *wq = wk->wq;
+  struct work *w;
+
+  for(;;){
+    push_off();
+    while(lst_empty(&wq->works))
+      waitq_sleep(&wq->idle, 1);
+    w = lst_entry(lst_pop(&wq->works), struct work, entry);
+    w->pending = 0;
+    pop_off();
+
+    w->func(w);
+  }
+}
+
+// 创建一个有nworkers个worker线程的工作队列
+struct workqueue*
+workqueue_create(char *name, int nworkers)
+{
+  struct workqueue *wq;
+  struct worker *wk;
+
+  if((wq = kmalloc(sizeof(*wq))) == 0)
+    return 0;
+  safestrcpy(wq->name, name, sizeof(wq->name));
+  lst_init(&wq->works);
+  waitq_init(&wq->idle);
+  wq->nworkers = 0;
+
+  for(int i = 0; i < nworkers; i++){
+    if((wk = kmalloc(sizeof(*wk))) == 0)
+      break;
+    wk->wq = wq;
+    if((wk->proc = kthread_create(worker_thread, wk, name)) == 0){
+      kfree(wk);
+      break;
+    }
+    wq->nworkers++;
+  }
+  if(wq->nworkers == 0){
+    kfree(wq);
+    return 0;
+  }
+  return wq;
+}
+
+// 把w加入工作队列并唤醒一个空闲的worker。
+// 可以在中断中调用。w已在排队时什么都不做, 返回0。
+int
+queue_work(struct workqueue *wq, struct work *w)
+{
+  push_off();
+  if(w->pending){
+    pop_off();
+    return 0;
+  }
+  w->pending = 1;
+  w->wq = wq;
+  lst_push_back(&wq->works, &w->entry);
+  wake_up(&wq->idle, 1);
+  pop_off();
+  return 1;
+}
+
+// 交给系统默认工作队列, 它创建之前什么都不做
+int
+schedule_work(struct work *w)
+{
+  if(system_wq == 0)
+    return 0;
+  return queue_work(system_wq, w);
+}
+
+// 取消还没开始执行的w。返回1表示取消前它还在排队。
+int
+cancel_work(struct work *w)
+{
+  int pending;
+
+  push_off();
+  pending = w->pending;
+  if(pending){
+    lst_remove(&w->entry);
+    w->pending = 0;
+  }
+  pop_off();
+  return pending;
+}
+
+// 创建系统默认工作队列, 需要在proc_init之后调用
+void
+workqueue_init(void)
+{
+  if((system_wq = workqueue_create("kworker", SYSTEM_WQ_WORKERS)) == 0)
+    panic("workqueue_init");
+}
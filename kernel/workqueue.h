@@ -0,0 +1,33 @@
+#ifndef __WORKQUEUE_H
+#define __WORKQUEUE_H
+
+#include "types.h"
+#include "list.h"
+#include "wait.h"
+
+// 推迟到内核线程中执行的工作。
+// 调用者把work嵌入自己的结构体, 回调中用lst_entry取回外层结构。
+struct work {
+  struct list entry;             // 工作队列中的链表节点
+  void (*func)(struct work *w);  // 在worker线程中执行, 可以睡眠
+  struct workqueue *wq;          // 排队所在的工作队列
+  int pending;                   // 是否已排队还未执行
+};
+
+// 一组worker内核线程共享的工作队列
+struct workqueue {
+  char name[16];
+  struct list works;             // 待执行的work, FIFO
+  struct wait_queue idle;        // 睡眠中等待work的worker, 排他等待
+  int nworkers;
+};
+
+static inline void
+work_init(struct work *w, void (*func)(struct work *))
+{
+  w->func = func;
+  w->wq = 0;
+  w->pending = 0;
+}
+
+#endif // __WORKQUEUE_H
@@ -0,0 +1,88 @@
+#!/usr/bin/env python3
+"""把采样分析器的输出(^R或prof(PROF_CMD_DUMP))符号化, 输出折叠栈格式.
+
+用法: prof2folded.py [-k kernel.elf] [-u user.elf] [--nm NM] console.log > out.folded
+      flamegraph.pl out.folded > flame.svg   (或导入 speedscope / inferno)
+
+每行 "pid N;外层函数;...;内层函数 样本数". 没有给出用户程序ELF时
+用户态的帧都折叠成 [user].
+"""
+
+import argparse
+import bisect
+import collections
+import shutil
+import subprocess
+import sys
+
+NM_CANDIDATES = ["riscv64-unknown-elf-nm", "riscv64-linux-gnu-nm", "llvm-nm", "nm"]
+
+
+class Symtab:
+    def __init__(self, elf, nm):
+        self.addrs = []
+        self.names = []
+        out = subprocess.run([nm, "-n", elf], check=True, capture_output=True,
+                             text=True).stdout
+        for line in out.splitlines():
+            f = line.split()
+            if len(f) != 3 or f[1] not in "tTwW":
+                continue
+            self.addrs.append(int(f[0], 16))
+            self.names.append(f[2])
+
+    def lookup(self, addr):
+        i = bisect.bisect_right(self.addrs, addr) - 1
+        if i < 0:
+            return "%#x" % addr
+        return self.names[i]
+
+
+def find_nm(nm):
+    for n in ([nm] if nm else NM_CANDIDATES):
+        if shutil.which(n):
+            return n
+    sys.exit("prof2folded: no nm found, use --nm")
+
+
+def main():
+    ap = argparse.ArgumentParser()
+    ap.add_argument("-k", "--kernel", default="kernel.elf")
+    ap.add_argument("-u", "--user")
+    ap.add_argument("--nm")
+    ap.add_argument("log", nargs="?")
+    args = ap.parse_args()
+
+    nm = find_nm(args.nm)
+    ksyms = Symtab(args.kernel, nm)
+    usyms = Symtab(args.user, nm) if args.user else None
+
+    counts = collections.Counter()
+    f = open(args.log) if args.log else sys.stdin
+    for line in f:
+        line = line.strip().replace("\r", "")
+        if line.startswith("@PROF "):
+            sys.stderr.write(line + "\n")
+            continue
+        if not line.startswith("@P "):
+            continue
+        fields = line.split()
+        pid, mode = fields[1], fields[2]
+        pcs = [int(x, 16) for x in fields[3:]]
+        syms = ksyms if mode == "k" else usyms
+        frames = []
+        for i, pc in enumerate(pcs):
+            if syms is None:
+                frames.append("[user]")
+                break
+            # 返回地址指向call的下一条指令, 减1落在调用者内部
+            frames.append(syms.lookup(pc if i == 0 else pc - 1))
+        stack = ["pid " + pid] + list(reversed(frames))
+        counts[";".join(stack)] += 1
+
+    for stack, n in sorted(counts.items()):
+        print(stack, n)
+
+
+if __name__ == "__main__":
+    main()
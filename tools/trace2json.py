@@ -0,0 +1,109 @@
+#!/usr/bin/env python3
+"""把内核跟踪缓冲区的输出(^T或trace(TRACE_CMD_DUMP))转换成Chrome trace JSON.
+
+用法: trace2json.py console.log > trace.json
+然后在 chrome://tracing 或 https://ui.perfetto.dev 中打开.
+
+每个进程一条时间线(PID 0 是调度器), 运行区间来自switch事件,
+陷入区间来自trap/trap_end, 其他事件画成瞬时事件.
+输入中可以混有普通的控制台输出, 只处理以@开头的行.
+"""
+
+import json
+import sys
+
+SCAUSE_NAMES = {
+    (1 << 63) | 1: "ssoft",
+    (1 << 63) | 5: "stimer",
+    (1 << 63) | 9: "sext",
+    2: "illegal",
+    8: "ecall",
+    12: "ipf",
+    13: "lpf",
+    15: "spf",
+}
+
+
+def parse(lines):
+    hz = 10000000
+    events = []
+    recs = []
+    for line in lines:
+        line = line.strip().replace("\r", "")
+        if line.startswith("@TRACE "):
+            for kv in line.split()[1:]:
+                k, _, v = kv.partition("=")
+                if k == "hz":
+                    hz = int(v)
+                elif k == "events":
+                    events = v.split(",")
+        elif line.startswith("@T "):
+            f = line.split()
+            if len(f) != 7:
+                continue
+            hart, time, ev, a0, a1, a2 = (int(x, 16) for x in f[1:])
+            recs.append((time, hart, ev, a0, a1, a2))
+        elif line.startswith("@TRACE-END"):
+            sys.stderr.write(line + "\n")
+    recs.sort()
+    return hz, events, recs
+
+
+def convert(hz, events, recs):
+    out = []
+    cur = {}  # hart -> 当前运行的PID
+    traps = {}  # (hart, pid) -> 未结束的陷入, 进程被切换出去时暂时关闭
+
+    def us(t):
+        return t * 1000000.0 / hz
+
+    def name(ev):
+        return events[ev] if ev < len(events) else "event%d" % ev
+
+    for time, hart, ev, a0, a1, a2 in recs:
+        n = name(ev)
+        ts = us(time)
+        pid = cur.get(hart, 0)
+        stack = traps.setdefault((hart, pid), [])
+        if n == "switch":
+            if hart in cur:
+                for _ in stack:
+                    out.append({"ph": "E", "pid": hart, "tid": pid, "ts": ts})
+                out.append({"ph": "E", "pid": hart, "tid": pid, "ts": ts})
+            cur[hart] = a1
+            out.append({"ph": "B", "pid": hart, "tid": a1, "ts": ts,
+                        "name": "run" if a1 else "scheduler",
+                        "args": {"direct": a2}})
+            for b in traps.get((hart, a1), []):
+                out.append(dict(b, ts=ts))
+        elif n == "trap":
+            b = {"ph": "B", "pid": hart, "tid": pid, "ts": ts,
+                 "name": SCAUSE_NAMES.get(a0, "trap %#x" % a0),
+                 "args": {"sepc": "%#x" % a1, "user": a2}}
+            stack.append(b)
+            out.append(b)
+        elif n == "trap_end":
+            # 新进程第一次返回用户态时没有对应的trap
+            if stack:
+                stack.pop()
+                out.append({"ph": "E", "pid": hart, "tid": pid, "ts": ts})
+        else:
+            out.append({"ph": "i", "s": "t", "pid": hart, "tid": pid,
+                        "ts": ts, "name": n,
+                        "args": {"a0": "%#x" % a0, "a1": "%#x" % a1,
+                                 "a2": "%#x" % a2}})
+    for hart in sorted({r[1] for r in recs}):
+        out.append({"ph": "M", "pid": hart, "name": "process_name",
+                    "args": {"name": "hart %d" % hart}})
+    return out
+
+
+def main():
+    f = open(sys.argv[1]) if len(sys.argv) > 1 else sys.stdin
+    hz, events, recs = parse(f)
+    json.dump({"traceEvents": convert(hz, events, recs),
+               "displayTimeUnit": "ns"}, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()